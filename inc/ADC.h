@@ -39,6 +39,24 @@ float temperature(void);
 bool adc_timer_init(uint8_t channel_num, uint8_t timer_num, uint32_t period,
                     uint8_t priority, void (*task)(uint16_t));
 
+// samples each of the channels (up to 8) every period cycles on adc 1 sequence
+// 0 and has the uDMA fill two blocks of block_len sample sets in turn, so
+// there's one interrupt per block instead of one per sample. The total rate
+// across all channels is capped at 1MSPS and a block can hold at most 1024
+// samples. Samples are interleaved in the order the channels were given.
+bool adc_stream_init(const uint8_t* channels, uint8_t num_channels,
+                     uint8_t timer_num, uint32_t period, uint16_t block_len,
+                     uint8_t priority);
+
+// block until the next block is full (timeout in cycles, 0 waits forever)
+// the block stays valid until the uDMA comes back around to it, which is one
+// block period after it was returned
+// returns null on timeout
+const uint16_t* adc_stream_read(uint32_t timeout);
+
+// number of blocks that were filled before the previous one was read
+uint32_t adc_stream_overruns(void);
+
 typedef struct {
     uint32_t port;
     uint32_t port_base;
@@ -11,6 +11,12 @@ typedef struct {
     struct TCB* blocked_head;
 } Sema4;
 
+// A set of 32 flags that threads can block on any or all of
+typedef struct {
+    uint32_t flags;
+    struct TCB* blocked_head;
+} EventGroup;
+
 // initialize OS controlled IO, timers, and heap
 // disables interrupts until OS_Launch
 void OS_Init(void);
@@ -23,30 +29,65 @@ void OS_Launch(uint32_t time_slice);
 // name is a static string label for the thread used for debugging
 // stack_size is the number of bytes to allocate for the task's stack
 // lower numbers = higher priority
-// returns false if this thread can not be added
-bool OS_AddThread(void (*task)(void), const char* name, uint32_t stack_size,
-                  uint32_t priority);
+// returns the new thread's id, or 0 if this thread can not be added
+uint32_t OS_AddThread(void (*task)(void), const char* name,
+                      uint32_t stack_size, uint32_t priority);
 
 // add a background periodic task
 // the task can't block, but it can call OS_Signal or OS_AddThread
 // period is in cycles
-// lower numbers = higher priority
-// returns false if this thread can not be added
-bool OS_AddPeriodicThread(void (*task)(void), uint32_t period,
-                          uint32_t priority);
+// lower numbers = higher priority (when released at the same time)
+// returns an id for the task, or 0 if this thread can not be added
+uint32_t OS_AddPeriodicThread(void (*task)(void), uint32_t period,
+                              uint32_t priority);
+
+// stop running a periodic task, returns false if there's no such task
+bool OS_RemovePeriodicThread(uint32_t id);
+
+// change the period of a periodic task, effective from its next release
+// returns false if there's no such task
+bool OS_SetPeriodicThreadPeriod(uint32_t id, uint32_t period);
 
 void OS_ReportJitter(void); // print jitter stats for periodic threads
+void OS_DumpJitter(void);   // print jitter histograms as CSV
+void OS_ResetJitter(void);  // start collecting jitter stats from scratch
+
+// add a realtime thread which runs task once every period
+// realtime threads are scheduled earliest deadline first ahead of all other
+// foreground threads, and each run of task should finish within deadline
+// cycles of its release. budget is the most cpu time one run of task takes
+// releases happen on the sleep timer's 1ms ticks
+// returns the new thread's id, or 0 if it can not be added or if the
+// realtime threads would no longer be guaranteed to meet their deadlines
+uint32_t OS_AddRealtimeThread(void (*task)(void), const char* name,
+                              uint32_t stack_size, uint32_t period,
+                              uint32_t deadline, uint32_t budget);
+
+// print deadline miss and budget overrun counts for realtime threads
+void OS_ReportRealtime(void);
 
 // add a background task to run whenever the SW1 (PF4) button is pushed
-// the task can't block, but it can call OS_Signal or OS_AddThread
+// it runs as deferred work so it's allowed to block
 void OS_AddSW1Task(void (*task)(void));
 
 // add a background task to run whenever the SW2 (PF0) button is pushed
-// the task can't block, but it can call OS_Signal or OS_AddThread
+// it runs as deferred work so it's allowed to block
 void OS_AddSW2Task(void (*task)(void));
 
+// queue task(arg) to run on the deferred work thread, which lets an interrupt
+// hand off slow work (or work that needs to block) and return. That thread has
+// priority 0, so it runs ahead of every other thread except realtime ones,
+// and a 512 byte stack that every task shares.
+// OS_Defer never blocks, and must only be called from interrupts (a thread
+// that wants this can just call the task)
+// returns false if the queue is full (or the thread couldn't be started) and
+// the work was dropped
+bool OS_Defer(void (*task)(void*), void* arg);
+uint32_t OS_DeferDropped(void); // number of times OS_Defer returned false
+
 uint32_t OS_Id(void);    // returns a unique id for the current_thread
 uint32_t OS_Time(void);  // return the system time in cycles
+uint64_t OS_Time64(void); // system time in cycles without wrapping
 void OS_ClearTime(void); // sets the system time to zero
 
 // suspend the current thread for AT LEAST a given number of cycles
@@ -54,11 +95,37 @@ void OS_Sleep(uint32_t time);
 void OS_Suspend(void); // suspend the current thread
 void OS_Kill(void);    // kill the current thread, releasing its stack
 
+// kill the current thread and report exit_code to any thread joining it
+void OS_Exit(int32_t exit_code);
+
+// block until the thread with the given id exits
+// exit_code (if not null) receives the value it passed to OS_Exit
+// returns false if there's no such thread (or its slot was already reused)
+bool OS_Join(uint32_t id, int32_t* exit_code);
+
 // set the starting value for a semaphore, 0 or more means available
 void OS_InitSemaphore(Sema4* semaPt, int32_t value);
 void OS_Wait(Sema4* semaPt);   // block until a semaphore is available
 void OS_Signal(Sema4* semaPt); // increment semaphore value (may wake thread)
 
+// like OS_Wait but gives up after timeout cycles (0 waits forever)
+// returns false if the semaphore wasn't acquired
+bool OS_WaitTimeout(Sema4* semaPt, uint32_t timeout);
+
+void OS_InitEvents(EventGroup* group); // clear all flags
+
+// set flags and wake any threads whose wait is now satisfied
+// safe to call from interrupts
+void OS_SetEvents(EventGroup* group, uint32_t flags);
+void OS_ClearEvents(EventGroup* group, uint32_t flags);
+
+// block until any (or all) of the flags in mask are set
+// if clear is true, the flags that satisfied the wait are cleared
+// timeout is in cycles, 0 waits forever
+// returns the flags in mask that were set, or 0 if the wait timed out
+uint32_t OS_WaitEvents(EventGroup* group, uint32_t mask, bool all, bool clear,
+                       uint32_t timeout);
+
 // These are used to dynamically load user code
 bool OS_AddProcess(void (*entry)(void), void* text, void* data,
                    uint32_t stack_size, uint32_t priority);
@@ -73,4 +140,10 @@ typedef enum {
 
 void OS_RedirectOutput(OutputDevice device);
 void OS_RedirectString(const char* str);
+// write len bytes as is (no newline is added)
+void OS_RedirectWrite(const char* buf, uint32_t len);
 void OS_RedirectChar(char c);
+// which ESP connection this thread's ESP output and input use (see
+// esp_socket_accept), 0 for new threads
+void OS_RedirectLink(uint8_t link);
+uint8_t OS_Link(void);
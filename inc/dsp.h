@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fixed point signal processing for sample blocks (like the ones from
+// adc_stream_read). Q15 values are in [-1, 1) scaled by 2^15 and Q31 values
+// are scaled by 2^31. The Q15 kernels work on pairs of samples at a time with
+// the Cortex-M4 SIMD instructions.
+typedef int16_t q15_t;
+typedef int32_t q31_t;
+
+// convert 12 bit unsigned adc samples to Q15 centered on mid scale
+// in and out can be the same buffer
+void adc_to_q15(const uint16_t* in, q15_t* out, uint32_t n);
+
+// saturating out[i] = a[i] + b[i]
+void q15_add(const q15_t* a, const q15_t* b, q15_t* out, uint32_t n);
+
+// root mean square and largest magnitude of a block
+void q15_stats(const q15_t* in, uint32_t n, q15_t* rms, q15_t* peak);
+
+// Finite impulse response filter
+typedef struct {
+    const q15_t* coeffs;
+    q15_t* state; // two copies of the window so it's always contiguous
+    uint16_t taps;
+    uint16_t idx;
+    uint16_t phase; // for decimation
+} FIRQ15;
+
+typedef struct {
+    const q31_t* coeffs;
+    q31_t* state;
+    uint16_t taps;
+    uint16_t idx;
+} FIRQ31;
+
+// coeffs must outlive the filter, and for Q15 taps must be even (pad the end
+// with a 0 coefficient if necessary)
+// returns null if it can't be allocated
+FIRQ15* fir_q15_new(const q15_t* coeffs, uint16_t taps);
+FIRQ31* fir_q31_new(const q31_t* coeffs, uint16_t taps);
+void fir_q15_free(FIRQ15* fir);
+void fir_q31_free(FIRQ31* fir);
+
+// filter n samples, in and out can be the same buffer
+void fir_q15(FIRQ15* fir, const q15_t* in, q15_t* out, uint32_t n);
+void fir_q31(FIRQ31* fir, const q31_t* in, q31_t* out, uint32_t n);
+
+// filter n samples and keep every factor'th output, skipping the work for the
+// others. The phase carries over between blocks.
+// returns the number of samples written to out
+uint32_t fir_q15_decimate(FIRQ15* fir, const q15_t* in, q15_t* out,
+                          uint32_t n, uint16_t factor);
+
+// Cascade of second order IIR sections (direct form 1). Each section's
+// coefficients are {b0, b1, b2, a1, a2} for
+// y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+// in Q14 for Q15 data and Q30 for Q31 data so that they can reach +-2
+typedef struct {
+    const int16_t (*coeffs)[5];
+    q15_t (*state)[4]; // x[n-1], x[n-2], y[n-1], y[n-2]
+    uint8_t stages;
+} BiquadQ15;
+
+typedef struct {
+    const int32_t (*coeffs)[5];
+    q31_t (*state)[4];
+    uint8_t stages;
+} BiquadQ31;
+
+// the Q15 version packs -a1 into a halfword, so a1 can't be -32768 (-2.0)
+// returns null if it is or if it can't be allocated
+BiquadQ15* biquad_q15_new(const int16_t (*coeffs)[5], uint8_t stages);
+BiquadQ31* biquad_q31_new(const int32_t (*coeffs)[5], uint8_t stages);
+void biquad_q15_free(BiquadQ15* iir);
+void biquad_q31_free(BiquadQ31* iir);
+
+void biquad_q15(BiquadQ15* iir, const q15_t* in, q15_t* out, uint32_t n);
+void biquad_q31(BiquadQ31* iir, const q31_t* in, q31_t* out, uint32_t n);
+
+// Running average over the last len samples
+typedef struct {
+    q15_t* window;
+    int32_t sum;
+    uint16_t len;
+    uint16_t idx;
+} MovingAverage;
+
+MovingAverage* moving_average_new(uint16_t len);
+void moving_average_free(MovingAverage* avg);
+
+// add a sample and return the new average
+q15_t moving_average(MovingAverage* avg, q15_t x);
+// average a whole block, in and out can be the same buffer
+void moving_average_block(MovingAverage* avg, const q15_t* in, q15_t* out,
+                          uint32_t n);
+
+// in place forward FFT of n interleaved complex values (re, im, re, im...)
+// each stage scales by 1/2 to avoid overflow so the output is scaled by 1/n
+// returns false unless n is a power of 2 from 2 to 1024
+bool fft_q15(q15_t* data, uint16_t n);
@@ -51,9 +51,6 @@ DRESULT eDisk_WriteBlock(const void* buff, uint32_t sector);
 
 void SSI0_Init(unsigned long CPSDVSR);
 
-// This implements timeout functions (should be called every ms)
-void disk_timerproc(void);
-
 // General purpose function for all disk I/O
 DRESULT disk_ioctl(uint8_t cmd, void* buff);
 
@@ -22,6 +22,13 @@ bool ESP8266_StopServer(void);
 // soft resets the esp8266 module
 bool ESP8266_Reset(void);
 
+// change the baud rate on both ends until the next reset (AT+UART_CUR), and
+// check the link still works, going back to the old rate if it doesn't
+// flow uses RTS/CTS on PC4/PC5, which needs the ESP's GPIO13 and GPIO15 wired
+// up (the ESP-01 doesn't have them)
+bool ESP8266_SetBaud(uint32_t rate, bool flow);
+uint32_t ESP8266_Baud(void);
+
 // restore the ESP8266 module to default values
 bool ESP8266_Restore(void);
 
@@ -54,6 +61,14 @@ bool ESP8266_MakeTCPConnection(char* address, uint16_t port);
 
 // Send a packet to server
 bool ESP8266_Send(const char* str);
+bool ESP8266_SendBytes(const char* buf, uint32_t len);
+
+// Queue bytes to send on the connection. Writes are collected into packets of
+// up to 2KB which a sender thread sends on a newline or ETX, when the packet
+// fills up, or after ESP_FLUSH_MS without either.
+void ESP8266_Write(const char* buf, uint32_t len);
+// start sending whatever has been queued without waiting
+void ESP8266_Flush(void);
 
 // Send a string to server using ESP TCP-send buffer
 bool ESP8266_SendBuffered(const char* str);
@@ -64,6 +79,15 @@ bool ESP8266_Receive(char* buf, uint32_t max);
 // Echos from data input until EOT is reached
 bool ESP8266_ReceiveEcho();
 
+// Switch the client connection to transparent mode (AT+CIPMODE=1) where
+// there's no AT framing at all, so data goes through at the full UART rate.
+// Only for a single connection (not while the server is running). Sends and
+// receives work as usual, but no other commands can be issued until it's
+// stopped, and a closed connection can't be detected.
+bool ESP8266_StartPassthrough(void);
+// takes a little over 2 seconds for the escape sequence
+bool ESP8266_StopPassthrough(void);
+
 // Close TCP connection
 bool ESP8266_CloseTCPConnection(void);
 
@@ -73,5 +97,30 @@ bool ESP8266_GetStatus(void);
 // set connection timeout for tcp server, 0-28800 seconds
 bool ESP8266_SetServerTimeout(uint16_t timeout);
 
-// wait for incoming connection on server
+// wait for incoming connection on server, and make it this thread's
+// connection for output and ESP8266_Receive
 bool ESP8266_WaitForConnection(void);
+
+// Socket style access to the individual connections (links) of the server.
+// Data received on each link is kept in its own ring, so several threads can
+// serve clients at the same time.
+#define ESP_LINKS 5
+
+// wait for a client to connect to the server and take ownership of it
+// timeout is in cycles, 0 waits forever
+// returns the new link, or -1 if the wait timed out
+int8_t esp_socket_accept(uint32_t timeout);
+
+// read up to max bytes received on a link, blocking until there's at least 1
+// timeout is in cycles, 0 waits forever
+// returns the number of bytes read, which is 0 on a timeout or once the link
+// is closed and everything it received has been read
+int32_t esp_socket_recv(uint8_t link, void* buf, uint32_t max,
+                        uint32_t timeout);
+
+// send a packet on a link and wait for the module to accept it (len is at
+// most 2048)
+bool esp_socket_send(uint8_t link, const char* buf, uint32_t len);
+
+bool esp_socket_close(uint8_t link);
+bool esp_socket_connected(uint8_t link);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+// Table driven and polynomial approximations of the usual math functions.
+// The error bounds are the worst case seen when sweeping the inputs against
+// double precision results (test/fastmath_test.c).
+
+// sin/cos of an angle in radians, linearly interpolated from a quarter wave
+// table. Absolute error < 2e-5 for |x| < 400000, past which the range
+// reduction isn't exact anymore (3e-2 by 1e6).
+float sin(float x);
+float cos(float x);
+
+// Fixed point sin/cos, angle is in 65536ths of a turn (so it wraps for free)
+// and the result is Q15. Absolute error <= 1 LSB.
+int16_t sin_q15(uint16_t angle);
+int16_t cos_q15(uint16_t angle);
+
+// single instruction hardware square root
+float sqrtf(float x);
+
+// integer square root, rounded down
+uint32_t isqrt(uint32_t x);
+
+// angle of (x, y) in radians from -pi to pi. Absolute error < 3e-6.
+float atan2f(float y, float x);
+
+// Relative error < 3e-7 for inputs from -87.33 to ln(FLT_MAX) = 88.72, below
+// that it returns 0 and above it infinity.
+float expf(float x);
+
+// Error < 2e-7 (relative when the result is over 1, absolute otherwise) for
+// normal inputs. Returns -infinity for 0 and NaN for negative inputs.
+float logf(float x);
@@ -6,7 +6,7 @@ typedef struct {
     uint8_t* buf;
     uint16_t putidx;
     uint16_t getidx;
-    Sema4 data_available;
+    EventGroup events; // wakes threads blocked in fifo_get/fifo_put
     uint16_t size;
 } FIFO;
 
@@ -15,8 +15,11 @@ FIFO* fifo_new(uint16_t size);
 void fifo_clear(FIFO* fifo);
 void fifo_free(FIFO* fifo);
 
+// block until there's space/data
 void fifo_put(FIFO* fifo, uint8_t n);
 uint8_t fifo_get(FIFO* fifo);
+// block for at most timeout cycles (0 waits forever), false if nothing came
+bool fifo_get_timeout(FIFO* fifo, uint8_t* out, uint32_t timeout);
 
 bool fifo_try_put(FIFO* fifo, uint8_t n);
 bool fifo_try_get(FIFO* fifo, uint8_t* out);
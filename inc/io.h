@@ -5,14 +5,22 @@
 #include <stdint.h>
 
 void uart_init(void);
+// waits for the bytes already written to be sent before switching
 void uart_change_speed(uint32_t baud);
 
 bool uart_putchar(char x);
-void uart_puts(const char* str);
+void uart_puts(const char* str); // adds a newline
+void uart_write(const char* buf, uint32_t len);
 #define puts(s) OS_RedirectString(s)
 #define putchar(c) OS_RedirectChar(c)
 
 char getchar(void);
+// read len bytes, waiting at most timeout cycles for each one (0 waits
+// forever), returns how many were read
+uint32_t uart_read(void* buf, uint32_t len, uint32_t timeout);
+// replace the receive buffer (size must be a power of 2), dropping anything
+// in it, so bulk transfers can have more in flight
+bool uart_rx_size(uint16_t size);
 uint16_t gets(char* str, uint16_t max);
 uint16_t readline(char* str, uint16_t max);
 
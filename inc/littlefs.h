@@ -1,6 +1,13 @@
+#pragma once
+
 #include <stdbool.h>
 #include <stdint.h>
 
+// reads and writes of this size go straight to the card
+#define LITTLEFS_BLOCK_SIZE 512
+// the longest file name
+#define LITTLEFS_NAME_MAX 63
+
 bool littlefs_init(void);
 
 bool littlefs_format(void);
@@ -14,21 +21,37 @@ bool littlefs_close_file(void);
 
 bool littlefs_read(uint8_t* output);
 bool littlefs_write(uint8_t c);
-uint16_t littlefs_read_line(char* str, uint16_t len);
 
 // These return number of bytes read/written or -1 on error
 int32_t littlefs_read_buffer(void* buffer, uint32_t size);
 int32_t littlefs_write_buffer(void* buffer, uint32_t size);
 
+// Files open on their own handles, for when more than one is needed at once
+// (the functions above all work on a single shared one)
+typedef struct lfs_file LittleFile;
+// write creates the file or truncates it, otherwise it's opened to read
+// returns 0 if it can't be opened
+LittleFile* littlefs_open(const char* name, bool write);
+int32_t littlefs_file_read(LittleFile* f, void* buffer, uint32_t size);
+int32_t littlefs_file_write(LittleFile* f, const void* buffer, uint32_t size);
+int32_t littlefs_file_size(LittleFile* f);
+// also frees the handle
+bool littlefs_close(LittleFile* f);
+
 bool littlefs_move(const char* name, const char* new_name);
 bool littlefs_remove(const char* name);
 
 bool littlefs_seek(int32_t off);
 
 bool littlefs_ls(void);
+// call each with the name and size of every file in the root directory
+bool littlefs_each(void (*each)(const char* name, uint32_t size, void* arg),
+                   void* arg);
 
 // Get position in file
 int32_t littlefs_tell(void);
+// Get the size of the open file, or -1 on error
+int32_t littlefs_size(void);
 
 // Check that the filesystem is working
 void littlefs_test(void);
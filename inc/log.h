@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Binary trace log. Instead of formatting on the target, LOG stores the
+// address of the format string, a timestamp and up to 4 raw arguments into a
+// ring in RAM, which costs a few dozen cycles and is safe to call from
+// interrupts. log_dump prints the records as hex and src/logdecode.py turns
+// them back into text using the strings in the ELF.
+//
+// Arguments are stored as 32 bit integers, so only integer, character and
+// pointer conversions make sense, and %s only works for strings that live in
+// flash (string literals and other constants) since only the pointer is kept.
+//
+// The format is part of the variadic arguments so a LOG with no arguments
+// still passes something to the ..., which strict C2x requires.
+#define LOG(...) LOG_(__VA_ARGS__, 0, 0, 0, 0, 0)
+#define LOG_(format, a, b, c, d, ...)                                          \
+    log_write(format, (uint32_t)(a), (uint32_t)(b), (uint32_t)(c),             \
+              (uint32_t)(d))
+
+// allocate the ring, records must be a power of 2
+// LOG does nothing until this is called
+// returns false if it can't be allocated
+bool log_init(uint16_t records);
+
+void log_write(const char* format, uint32_t a, uint32_t b, uint32_t c,
+               uint32_t d);
+
+// print every record still in the ring, oldest first, one per line as
+// "@L seq time format a b c d" in hex
+void log_dump(void);
+
+// forget every record
+void log_clear(void);
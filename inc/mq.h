@@ -0,0 +1,46 @@
+#pragma once
+
+#include "OS.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A queue of fixed size messages. Producers reserve a slot and fill it in
+// place, consumers read it in place and release it, so messages are never
+// copied. Blocked senders and receivers are woken in priority order.
+typedef struct {
+    uint8_t* slots;
+    uint8_t* state; // SLOT_* for each slot
+    uint16_t msg_size;
+    uint16_t mask;
+    uint16_t reserve_idx; // next slot to hand to a producer
+    uint16_t commit_idx;  // next slot to make visible to consumers
+    uint16_t receive_idx; // next slot to hand to a consumer
+    uint16_t release_idx; // next slot to give back to producers
+    Sema4 free;           // slots that can be reserved
+    Sema4 ready;          // committed messages that can be received
+} MQueue;
+
+// depth must be a power of 2
+// returns null if it can't be allocated
+MQueue* mq_new(uint16_t msg_size, uint16_t depth);
+void mq_free(MQueue* mq);
+
+// get an empty slot to write a message into, blocking while the queue is full
+// timeout is in cycles, 0 waits forever
+// returns null if the wait timed out
+void* mq_reserve(MQueue* mq, uint32_t timeout);
+// like mq_reserve but never blocks (safe to call from interrupts)
+void* mq_try_reserve(MQueue* mq);
+// send a reserved message (safe to call from interrupts)
+// messages are received in the order they were reserved
+void mq_commit(MQueue* mq, void* msg);
+
+// get the oldest message, blocking while the queue is empty
+// timeout is in cycles, 0 waits forever
+// returns null if the wait timed out
+void* mq_receive(MQueue* mq, uint32_t timeout);
+// hand a received message's slot back to the producers
+void mq_release(MQueue* mq, void* msg);
+
+// number of committed messages waiting to be received
+uint16_t mq_size(MQueue* mq);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "OS.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A unit of work for the thread pool. The caller owns the storage (it can live
+// on the submitter's stack) so submitting a job never touches the heap.
+typedef struct {
+    int32_t (*task)(void* arg);
+    void* arg;
+    int32_t result;
+    Sema4 done;
+} Job;
+
+// spawn the pool's worker threads, each with a stack that is reused for every
+// job it runs. queue_size is the number of jobs that can be waiting at once
+// and must be a power of 2
+// returns false if the workers or queue couldn't be allocated, after stopping
+// any workers that were started, so it has to be called from a thread
+bool pool_init(uint8_t workers, uint32_t stack_size, uint32_t priority,
+               uint16_t queue_size);
+
+// queue a job, blocking while the queue is full
+// returns false if there's no pool (pool_init hasn't succeeded)
+bool pool_submit(Job* job, int32_t (*task)(void* arg), void* arg);
+
+// queue a job without blocking (safe to call from interrupts)
+// returns false if the queue is full or there's no pool
+bool pool_try_submit(Job* job, int32_t (*task)(void* arg), void* arg);
+
+// block until a submitted job finishes and return its result
+int32_t pool_wait(Job* job);
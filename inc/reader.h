@@ -0,0 +1,40 @@
+#pragma once
+
+#include "littlefs.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Reads a file a block at a time and hands it out in whatever pieces are
+// wanted, so going through text a line at a time doesn't cost a filesystem
+// call per byte. Don't read the file directly while a reader has it.
+typedef struct {
+    LittleFile* file; // 0 for the one opened with littlefs_open_file
+    uint8_t* buf;     // LITTLEFS_BLOCK_SIZE bytes read ahead
+    uint16_t start;   // next byte to hand out
+    uint16_t end;     // how much of buf is filled
+    bool error;
+} Reader;
+
+// returns false if there's no memory for the buffer
+bool reader_init(Reader* r, LittleFile* file);
+// frees the buffer, the file stays open
+void reader_free(Reader* r);
+// forget what was read ahead, after the file has been seeked
+void reader_reset(Reader* r);
+
+// returns the number of bytes read, fewer than len only at the end of the
+// file, or -1 on error
+int32_t reader_read(Reader* r, void* buf, uint32_t len);
+// copy up to and including delim into str and nul terminate it, stopping
+// early if it doesn't fit in len - 1 bytes (the rest comes next time)
+// returns the length copied, 0 at the end of the file, or -1 on error
+int32_t reader_read_until(Reader* r, char delim, char* str, uint32_t len);
+// the next line without its "\n" or "\r\n", split up like reader_read_until
+// if it's too long
+// returns its length, or -1 at the end of the file or on error (see r->error)
+int32_t reader_getline(Reader* r, char* str, uint32_t len);
+// point out to the next bytes up to and including delim, or the rest of what's
+// buffered if it isn't there, without copying them (they're only good until
+// the next call)
+// returns how many there are, 0 at the end of the file, or -1 on error
+int32_t reader_next(Reader* r, char delim, const uint8_t** out);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// SHA-256, fed a piece at a time. Lengths are kept in 32 bits so it's good for
+// anything under 512MB.
+typedef struct {
+    uint32_t state[8];
+    uint32_t count; // bytes hashed so far
+    uint8_t block[64];
+} Sha256;
+
+void sha256_init(Sha256* ctx);
+void sha256_update(Sha256* ctx, const void* data, uint32_t len);
+// pad out the last block and write the 32 byte digest
+void sha256_final(Sha256* ctx, uint8_t* digest);
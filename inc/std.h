@@ -8,9 +8,9 @@ typedef uint32_t size_t;
 #define PI 3.14159265f
 
 int32_t abs(int32_t n);
-float sin(float x);
-float cos(float x);
 uint32_t difference(uint32_t a, uint32_t b);
+// n / d for a quotient that fits in 32 bits (n >> 32 must be less than d)
+uint32_t udiv64(uint64_t n, uint32_t d);
 int32_t min(int32_t a, int32_t b);
 int32_t max(int32_t a, int32_t b);
 bool streq(const char* a, const char* b);
@@ -27,6 +27,7 @@ char* itoa(int32_t value, char* buf, uint8_t radix);
 void memcpy(void* dest, const void* src, uint32_t n);
 void memset(void* dest, uint8_t value, uint32_t n);
 int memcmp(const void* s1, const void* s2, uint32_t n);
+void* memchr(const void* s, int c, uint32_t n);
 char* strcpy(char* dest, const char* src);
 char* strchr(const char* str, int c);
 size_t strspn(const char* str1, const char* str2);
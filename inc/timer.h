@@ -36,6 +36,12 @@ float to_seconds(uint32_t time);
 void timer_enable(uint8_t timer_num, uint32_t period, void (*task)(void),
                   uint8_t priority, bool periodic);
 
+// Restart a timer set up by timer_enable with a new period
+void timer_restart(uint8_t timer_num, uint32_t period);
+
+// Stop a timer set up by timer_enable
+void timer_stop(uint8_t timer_num);
+
 // Spin
 void busy_wait(uint8_t timer_num, uint32_t duration);
 
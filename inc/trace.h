@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Kernel event tracer. When enabled, context switches, semaphore waits and
+// signals, wakeups, sleeps and interrupt handlers are timestamped into a
+// circular buffer that keeps the most recent TRACE_EVENTS events. Dump it with
+// the trace command and convert it with src/trace2json.py to view it in
+// chrome://tracing or Perfetto.
+// #define TRACE_KERNEL
+
+#define TRACE_EVENTS 128 // must be a power of 2
+
+typedef enum {
+    TRACE_SWITCH,    // a = thread id now running, b = its priority
+    TRACE_THREAD,    // a = id of a new thread, b = its name
+    TRACE_EXIT,      // a = id of a thread that exited
+    TRACE_READY,     // a = id of a thread made runnable, b = its priority
+    TRACE_WAIT,      // a = semaphore, b = true if the caller blocked
+    TRACE_SIGNAL,    // a = semaphore, b = id of the thread woken or 0
+    TRACE_SLEEP,     // a = id of the thread going to sleep, b = cycles
+    TRACE_TIMEOUT,   // a = id of a thread whose timed wait ran out
+    TRACE_ISR_ENTER, // a = exception number
+    TRACE_ISR_EXIT,  // a = exception number
+} TraceType;
+
+#ifdef TRACE_KERNEL
+#define TRACE(type, a, b) trace_event(type, (uint32_t)(a), (uint32_t)(b))
+#define TRACE_ISR_ENTER() trace_event(TRACE_ISR_ENTER, trace_ipsr(), 0)
+#define TRACE_ISR_EXIT() trace_event(TRACE_ISR_EXIT, trace_ipsr(), 0)
+#else
+#define TRACE(type, a, b) ((void)0)
+#define TRACE_ISR_ENTER() ((void)0)
+#define TRACE_ISR_EXIT() ((void)0)
+#endif
+
+void trace_event(TraceType type, uint32_t a, uint32_t b);
+
+// exception number of the running handler
+static inline uint32_t trace_ipsr(void) {
+    uint32_t ipsr;
+    __asm volatile("MRS %0, IPSR" : "=r"(ipsr));
+    return ipsr;
+}
+
+// print the buffer, oldest first, with one "@K time type a b" line per event
+// (in hex) followed by a "@N id name" line for every thread seen
+// recording is paused while dumping so the dump doesn't trace itself
+void trace_dump(void);
+
+// same as trace_dump but written to a file on the sd card
+// returns false if the file can't be written
+bool trace_save(const char* name);
+
+// forget every event
+void trace_clear(void);
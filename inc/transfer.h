@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Framed binary file transfer. `upload` receives files from
+// userprog/transfer.py over the UART and `download` sends them to
+// userprog/download.py over the UART or the ESP connection. Each frame is
+//   0x7e, type, seq (2 bytes), length (2 bytes), payload, crc (4 bytes)
+// little endian, where the crc is the CRC-32 (same as zlib's) of everything
+// after the 0x7e. Data frames carry up to TRANSFER_PAYLOAD bytes, one
+// filesystem block, and the sender can have TRANSFER_WINDOW of them waiting
+// to be acknowledged. The receiver answers with 3 bytes: 'A' and the next seq
+// it wants, 'N' and the seq to go back to after a bad frame, or 'X' to give
+// up. The last frame is an end frame carrying the size and CRC-32 of the
+// whole file, even when the download is resumed partway through. The receiver
+// checks that against what it already had plus what it got, so a file that
+// changed before the resume point is caught (and fetched again from the
+// start).
+#define TRANSFER_PAYLOAD 512
+#define TRANSFER_WINDOW 4
+
+// receive a file into name, switching the UART to baud for the transfer (0 to
+// stay at 115200)
+// returns the number of bytes received or -1 on failure, in which case an
+// existing file by that name is left as it was
+int32_t transfer_receive(const char* name, uint32_t baud);
+
+// send a file starting offset bytes in (to resume an earlier download), over
+// this thread's ESP connection if remote or the UART otherwise
+// resuming reads the first offset bytes again for the end frame's CRC
+// returns the number of bytes sent or -1 on failure
+int32_t transfer_send(const char* name, uint32_t offset, bool remote);
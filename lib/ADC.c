@@ -1,11 +1,16 @@
 #include "ADC.h"
+#include "OS.h"
+#include "heap.h"
 #include "std.h"
 #include "timer.h"
 #include "tivaware/adc.h"
+#include "tivaware/hw_adc.h"
 #include "tivaware/hw_ints.h"
 #include "tivaware/hw_memmap.h"
 #include "tivaware/rom.h"
 #include "tivaware/timer.h"
+#include "tivaware/udma.h"
+#include "trace.h"
 #include <stdint.h>
 
 bool adc_init(uint8_t channel_num) {
@@ -54,22 +59,67 @@ float temperature(void) {
 
 static void (*process_sample)(uint16_t);
 
+// In stream mode the uDMA fills two blocks in ping-pong mode and the ADC1 SS0
+// interrupt only fires when one of them is full
+static bool streaming;
+static uint16_t* stream_blocks[2];
+static uint16_t stream_block_size; // in samples, across all channels
+static uint8_t stream_channels;
+static volatile uint8_t stream_ready; // index of the last block filled
+static Sema4 stream_full;
+static uint32_t stream_overruns;
+
+// the control table has to be 1024 byte aligned
+static tDMAControlTable dma_table[64] __attribute__((aligned(1024)));
+
+static void stream_arm(uint32_t select, uint16_t* block) {
+    ROM_uDMAChannelTransferSet(
+        UDMA_SEC_CHANNEL_ADC10 | select, UDMA_MODE_PINGPONG,
+        (void*)(ADC1_BASE + ADC_O_SSFIFO0), block, stream_block_size);
+}
+
 void adc1_sequence0_handler(void) {
+    TRACE_ISR_ENTER();
     ROM_ADCIntClear(ADC1_BASE, 0);
-    uint32_t temp;
-    ROM_ADCSequenceDataGet(ADC1_BASE, 0, &temp);
-    process_sample(temp);
+    if (!streaming) {
+        uint32_t temp;
+        ROM_ADCSequenceDataGet(ADC1_BASE, 0, &temp);
+        process_sample(temp);
+        TRACE_ISR_EXIT();
+        return;
+    }
+    // whichever half has stopped is full, rearm it while the other one fills
+    for (uint8_t i = 0; i < 2; i++) {
+        uint32_t select = i ? UDMA_ALT_SELECT : UDMA_PRI_SELECT;
+        if (ROM_uDMAChannelModeGet(UDMA_SEC_CHANNEL_ADC10 | select) ==
+            UDMA_MODE_STOP) {
+            stream_arm(select, stream_blocks[i]);
+            stream_ready = i;
+            if (stream_full.value >= 0) { // consumer hasn't taken the last one
+                stream_overruns++;
+            } else {
+                OS_Signal(&stream_full);
+            }
+        }
+    }
+    TRACE_ISR_EXIT();
 }
 
-bool adc_timer_init(uint8_t channel_num, uint8_t timer_num, uint32_t period,
-                    uint8_t priority, void (*task)(uint16_t)) {
-    period = max(period, hz(10000)); // max sample rate = 10kHz
+static void adc_trigger_timer_init(uint8_t timer_num, uint32_t period) {
     TimerConfig timer_config = timers[timer_num];
     ROM_SysCtlPeripheralEnable(timer_config.sysctl_periph);
     ROM_TimerConfigure(timer_config.base, TIMER_CFG_PERIODIC);
     ROM_TimerControlStall(timer_config.base, TIMER_A, true);
     ROM_TimerLoadSet(timer_config.base, TIMER_A, period);
     ROM_TimerControlTrigger(timer_config.base, TIMER_BOTH, true);
+}
+
+bool adc_timer_init(uint8_t channel_num, uint8_t timer_num, uint32_t period,
+                    uint8_t priority, void (*task)(uint16_t)) {
+    period = max(period, hz(10000)); // max sample rate = 10kHz
+    streaming = false;
+    TimerConfig timer_config = timers[timer_num];
+    adc_trigger_timer_init(timer_num, period);
 
     ADCConfig adc_config = adcs[channel_num];
     ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_ADC1);
@@ -88,6 +138,89 @@ bool adc_timer_init(uint8_t channel_num, uint8_t timer_num, uint32_t period,
     return true;
 }
 
+bool adc_stream_init(const uint8_t* channels, uint8_t num_channels,
+                     uint8_t timer_num, uint32_t period, uint16_t block_len,
+                     uint8_t priority) {
+    uint32_t block_size = block_len * num_channels;
+    if (!num_channels || num_channels > 8 || !block_len ||
+        block_size > 1024 || stream_blocks[0]) {
+        return false;
+    }
+    for (uint8_t i = 0; i < num_channels; i++) {
+        if (channels[i] > 11) {
+            return false;
+        }
+    }
+    // the ADC converts 1M samples per second in total across all channels
+    period = max(period, hz(1000000 / num_channels));
+    stream_blocks[0] = malloc(2 * block_size * sizeof(uint16_t));
+    if (!stream_blocks[0]) {
+        return false;
+    }
+    stream_blocks[1] = stream_blocks[0] + block_size;
+    stream_block_size = block_size;
+    stream_channels = num_channels;
+    stream_overruns = 0;
+    OS_InitSemaphore(&stream_full, -1);
+    streaming = true;
+
+    adc_trigger_timer_init(timer_num, period);
+    ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_ADC1);
+    for (uint8_t i = 0; i < num_channels; i++) {
+        ADCConfig adc_config = adcs[channels[i]];
+        ROM_SysCtlPeripheralEnable(adc_config.port);
+        ROM_GPIOPinTypeADC(adc_config.port_base, adc_config.pin);
+    }
+    ROM_ADCHardwareOversampleConfigure(ADC1_BASE, 0);
+    ROM_ADCSequenceConfigure(ADC1_BASE, 0, ADC_TRIGGER_TIMER, 0);
+    for (uint8_t i = 0; i < num_channels; i++) {
+        // every step raises a uDMA request for its one sample (UDMA_ARB_1),
+        // so the FIFO is emptied as it fills and the channels stay in order
+        uint32_t last = i == num_channels - 1 ? ADC_CTL_END : 0;
+        ROM_ADCSequenceStepConfigure(ADC1_BASE, 0, i,
+                                     channels[i] | ADC_CTL_IE | last);
+    }
+
+    ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_UDMA);
+    ROM_uDMAEnable();
+    ROM_uDMAControlBaseSet(dma_table);
+    ROM_uDMAChannelAssign(UDMA_CH24_ADC1_0);
+    ROM_uDMAChannelAttributeDisable(UDMA_SEC_CHANNEL_ADC10,
+                                    UDMA_ATTR_ALTSELECT | UDMA_ATTR_USEBURST |
+                                        UDMA_ATTR_HIGH_PRIORITY |
+                                        UDMA_ATTR_REQMASK);
+    uint32_t control =
+        UDMA_SIZE_16 | UDMA_SRC_INC_NONE | UDMA_DST_INC_16 | UDMA_ARB_1;
+    ROM_uDMAChannelControlSet(UDMA_SEC_CHANNEL_ADC10 | UDMA_PRI_SELECT,
+                              control);
+    ROM_uDMAChannelControlSet(UDMA_SEC_CHANNEL_ADC10 | UDMA_ALT_SELECT,
+                              control);
+    stream_arm(UDMA_PRI_SELECT, stream_blocks[0]);
+    stream_arm(UDMA_ALT_SELECT, stream_blocks[1]);
+    // on the TM4C123 an unmasked uDMA channel is all it takes for the
+    // sequencer to make requests
+    ROM_uDMAChannelEnable(UDMA_SEC_CHANNEL_ADC10);
+
+    // the IE steps are only for the uDMA, its completion still interrupts
+    ROM_ADCIntDisable(ADC1_BASE, 0);
+    ROM_IntEnable(INT_ADC1SS0);
+    ROM_IntPrioritySet(INT_ADC1SS0, priority << 5);
+    ROM_ADCSequenceEnable(ADC1_BASE, 0);
+    ROM_TimerEnable(timers[timer_num].base, TIMER_BOTH);
+    return true;
+}
+
+const uint16_t* adc_stream_read(uint32_t timeout) {
+    if (!OS_WaitTimeout(&stream_full, timeout)) {
+        return 0;
+    }
+    return stream_blocks[stream_ready];
+}
+
+uint32_t adc_stream_overruns(void) {
+    return stream_overruns;
+}
+
 const ADCConfig adcs[12] = {{SYSCTL_PERIPH_GPIOE, GPIO_PORTE_BASE, GPIO_PIN_3},
                             {SYSCTL_PERIPH_GPIOE, GPIO_PORTE_BASE, GPIO_PIN_2},
                             {SYSCTL_PERIPH_GPIOE, GPIO_PORTE_BASE, GPIO_PIN_1},
@@ -23,6 +23,7 @@
 #include "tivaware/mpu.h"
 #include "tivaware/rom.h"
 #include "tivaware/timer.h"
+#include "trace.h"
 #include <stdint.h>
 #include <stdnoreturn.h>
 
@@ -43,19 +44,52 @@ typedef struct TCB {
     uint32_t id;
     const char* name;
     OutputDevice out_device;
+    uint8_t esp_link;
 
     struct TCB* next_blocked;
+    struct TCB** blocked_list; // head of the list this thread is blocked in
+    int32_t* blocked_count;    // semaphore value to give back on a timeout
 
     uint32_t sleep_time;
 
+    // what this thread is waiting for when blocked on an EventGroup
+    uint32_t wait_mask;
+    uint32_t wait_result; // 0 if a timed wait ran out
+    bool wait_all;
+    bool wait_clear;
+
+    Sema4 exited;        // threads blocked in OS_Join on this one
+    int32_t exit_code;   // value passed to OS_Exit
+    int32_t join_result; // exit code of the thread this one joined
+
     bool asleep;
     bool blocked;
     bool alive;
     uint8_t priority;
 
+    struct RTParams* rt; // only set for realtime threads
+
     uint32_t* stack;
 } TCB;
 
+// Realtime threads run their task once per period and are scheduled earliest
+// deadline first, ahead of every fixed priority thread
+typedef struct RTParams {
+    void (*task)(void);
+    uint32_t period;
+    uint32_t relative_deadline;
+    uint32_t budget;
+    float density; // budget / min(period, deadline), used for admission
+
+    uint32_t release;  // absolute time the current job was released
+    uint32_t deadline; // absolute deadline of the current job
+    uint32_t job_time; // cpu time used by the current job so far
+
+    uint32_t jobs;
+    uint32_t deadline_misses;
+    uint32_t budget_overruns;
+} RTParams;
+
 #define MAX_THREADS 8
 #define MAX_PROCESSES 4
 #define MIN_STACK_SIZE 512
@@ -94,18 +128,34 @@ static void insert_behind(TCB* a, TCB* b) {
     b->prev_tcb = a;
 }
 
+// whether thread a should be scheduled ahead of thread b
+static bool precedes(const TCB* a, const TCB* b) {
+    if (a->rt && b->rt) {
+        return (int32_t)(a->rt->deadline - b->rt->deadline) < 0;
+    } else if (a->rt || b->rt) {
+        return a->rt;
+    }
+    return a->priority < b->priority;
+}
+
+// whether two threads should share a time sliced run queue
+static bool same_level(const TCB* a, const TCB* b) {
+    return !precedes(a, b) && !precedes(b, a);
+}
+
 static void insert_thread(TCB* adding) {
     uint32_t crit = start_critical();
-    if (adding->priority < current_thread->priority) {
+    TRACE(TRACE_READY, adding->id, adding->priority);
+    if (precedes(adding, (TCB*)current_thread)) {
         TCB* next = current_thread->next_tcb;
-        if (adding->priority < next->priority) {
+        if (precedes(adding, next)) {
             adding->next_tcb = adding->prev_tcb = adding;
             current_thread->next_tcb = adding;
             OS_Suspend();
-        } else if (next->priority == adding->priority) {
+        } else if (same_level(next, adding)) {
             insert_behind(adding, next);
         }
-    } else if (adding->priority == current_thread->priority) {
+    } else if (same_level(adding, (TCB*)current_thread)) {
         insert_behind(adding,
                       (current_thread->blocked || current_thread->asleep)
                           ? current_thread->next_tcb
@@ -114,27 +164,32 @@ static void insert_thread(TCB* adding) {
     end_critical(crit);
 }
 
+// build a run queue out of the ready threads that should be scheduled first
+static TCB* ready_threads(void) {
+    uint8_t my_count = thread_count;
+    TCB* new_current = &idle;
+    idle.next_tcb = &idle;
+    for (int i = 0; my_count > 0; ++i) {
+        if (!threads[i].alive) {
+            continue;
+        }
+        --my_count;
+        if (!(threads[i].asleep || threads[i].blocked)) {
+            if (precedes(&threads[i], new_current)) {
+                new_current = &threads[i];
+                new_current->next_tcb = new_current->prev_tcb = new_current;
+            } else if (same_level(&threads[i], new_current)) {
+                insert_behind(&threads[i], new_current);
+            }
+        }
+    }
+    return new_current;
+}
+
 // only called from sleep/kill/suspend so no additional critical section needed
 static void remove_current_thread() {
     if (current_thread->next_tcb == current_thread) {
-        uint8_t my_count = thread_count;
-        TCB* new_current = &idle;
-        idle.next_tcb = &idle;
-        for (int i = 0; my_count > 0; ++i) {
-            if (!threads[i].alive) {
-                continue;
-            }
-            --my_count;
-            if (!(threads[i].asleep || threads[i].blocked)) {
-                if (threads[i].priority < new_current->priority) {
-                    new_current = &threads[i];
-                    new_current->next_tcb = new_current->prev_tcb = new_current;
-                } else if (threads[i].priority == new_current->priority) {
-                    insert_behind(&threads[i], new_current);
-                }
-            }
-        }
-        current_thread->next_tcb = new_current;
+        current_thread->next_tcb = ready_threads();
     } else {
         current_thread->prev_tcb->next_tcb = current_thread->next_tcb;
         current_thread->next_tcb->prev_tcb = current_thread->prev_tcb;
@@ -142,11 +197,68 @@ static void remove_current_thread() {
     OS_Suspend();
 }
 
+// called when the running thread's precedence drops without it blocking
+static void reschedule_current_thread() {
+    TCB* next = ready_threads();
+    if (!same_level(next, (TCB*)current_thread)) {
+        current_thread->next_tcb = next;
+    }
+    OS_Suspend();
+}
+
 static void portd_init(void) {
     ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOD);
     ROM_GPIOPinTypeGPIOOutput(GPIO_PORTD_BASE, 0x0F);
 }
 
+// Deferred work is queued by interrupts and run in order by a thread at
+// priority 0, so only realtime threads run ahead of it. Only interrupts
+// enqueue and only that thread dequeues, and since an interrupt always
+// finishes before any thread runs, claiming a slot with a compare and swap on
+// putidx is enough for nested interrupts to share the ring without masking
+// anything.
+#define DEFER_QUEUE_SIZE 16 // must be a power of 2
+// the work queued in this tree is USB event printfs and button tasks, and
+// printf's line buffer and number formatting are what take the most stack
+#define DEFER_STACK_SIZE 512
+typedef struct {
+    void (*task)(void*);
+    void* arg;
+} Deferred;
+static Deferred defer_queue[DEFER_QUEUE_SIZE];
+static volatile uint32_t defer_putidx;
+static volatile uint32_t defer_getidx;
+static Sema4 defer_pending;
+static uint32_t defer_dropped;
+static bool defer_running; // false if the thread couldn't be added
+
+static void defer_thread(void) {
+    while (true) {
+        OS_Wait(&defer_pending);
+        Deferred work = defer_queue[defer_getidx % DEFER_QUEUE_SIZE];
+        defer_getidx++; // the slot can be reused now that it's copied
+        work.task(work.arg);
+    }
+}
+
+bool OS_Defer(void (*task)(void*), void* arg) {
+    uint32_t idx = defer_putidx;
+    do {
+        if (!defer_running || idx - defer_getidx >= DEFER_QUEUE_SIZE) {
+            defer_dropped++;
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&defer_putidx, &idx, idx + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    defer_queue[idx % DEFER_QUEUE_SIZE] = (Deferred){task, arg};
+    OS_Signal(&defer_pending);
+    return true;
+}
+
+uint32_t OS_DeferDropped(void) {
+    return defer_dropped;
+}
+
 void OS_Init(void) {
     disable_interrupts();
     os_running = false;
@@ -157,6 +269,9 @@ void OS_Init(void) {
     uart_init();
     temperature_init();
     SSI0_Init(10);
+    OS_InitSemaphore(&defer_pending, -1);
+    defer_running =
+        OS_AddThread(defer_thread, "Deferred work", DEFER_STACK_SIZE, 0);
 }
 
 void OS_InitSemaphore(Sema4* sem, int32_t value) {
@@ -164,72 +279,181 @@ void OS_InitSemaphore(Sema4* sem, int32_t value) {
     sem->blocked_head = 0;
 }
 
+// add the current thread to a blocked list, ordered so that the thread that
+// should be scheduled first is at the head
+static void block_current_thread(TCB** list, int32_t* count) {
+    TCB* blocking = (TCB*)current_thread;
+    blocking->blocked = true;
+    blocking->blocked_list = list;
+    blocking->blocked_count = count;
+    while (*list && !precedes(blocking, *list)) {
+        list = &(*list)->next_blocked;
+    }
+    blocking->next_blocked = *list;
+    *list = blocking;
+}
+
+// take a blocked thread out of the list it's waiting in
+static void unlink_blocked_thread(TCB* thread) {
+    TCB** list = thread->blocked_list;
+    while (*list && *list != thread) { list = &(*list)->next_blocked; }
+    if (*list) {
+        *list = thread->next_blocked;
+    }
+}
+
+// make a thread that was removed from a blocked list runnable again
+static void wake_thread(TCB* thread) {
+    thread->blocked = false;
+    thread->asleep = false; // cancel any timeout
+    insert_thread(thread);
+}
+
+// start counting down a sleep for the current thread, which still needs to be
+// removed from the run queue
+static void start_sleeping(uint32_t time) {
+    current_thread->asleep = true;
+    current_thread->sleep_time =
+        time + get_timer_reload(1) - get_timer_value(1);
+}
+
 void OS_Wait(Sema4* sem) {
+    OS_WaitTimeout(sem, 0);
+}
+
+bool OS_WaitTimeout(Sema4* sem, uint32_t timeout) {
     uint32_t crit = start_critical();
-    current_thread->next_blocked = 0;
     if (sem->value-- >= 0) {
+        TRACE(TRACE_WAIT, sem, false);
         end_critical(crit);
-        return;
+        return true;
     }
-    current_thread->blocked = true;
-    if (!sem->blocked_head) {
-        sem->blocked_head = (TCB*)current_thread;
-    } else {
-        TCB* tail = sem->blocked_head;
-        while (tail->next_blocked &&
-               tail->next_blocked->priority <= current_thread->priority) {
-            tail = tail->next_blocked;
-        }
-        current_thread->next_blocked = tail->next_blocked;
-        tail->next_blocked = (TCB*)current_thread;
+    TRACE(TRACE_WAIT, sem, true);
+    current_thread->wait_result = 1;
+    block_current_thread(&sem->blocked_head, &sem->value);
+    if (timeout) {
+        start_sleeping(timeout);
     }
     remove_current_thread();
-    end_critical(crit);
+    end_critical(crit); // the context switch happens here
+    return current_thread->wait_result;
 }
 
 void OS_Signal(Sema4* sem) {
     uint32_t crit = start_critical();
     if (++sem->value >= 0) {
+        TRACE(TRACE_SIGNAL, sem, 0);
         end_critical(crit);
         return;
     }
-    sem->blocked_head->blocked = false;
-    insert_thread(sem->blocked_head);
-    sem->blocked_head = sem->blocked_head->next_blocked;
+    TCB* waking = sem->blocked_head;
+    sem->blocked_head = waking->next_blocked;
+    TRACE(TRACE_SIGNAL, sem, waking->id);
+    wake_thread(waking);
     end_critical(crit);
 }
 
+void OS_InitEvents(EventGroup* group) {
+    group->flags = 0;
+    group->blocked_head = 0;
+}
+
+static uint32_t events_matched(uint32_t flags, uint32_t mask, bool all) {
+    uint32_t matched = flags & mask;
+    return (all ? matched == mask : matched) ? matched : 0;
+}
+
+void OS_SetEvents(EventGroup* group, uint32_t flags) {
+    uint32_t crit = start_critical();
+    group->flags |= flags;
+    TCB** link = &group->blocked_head;
+    while (*link) {
+        TCB* waiter = *link;
+        uint32_t matched =
+            events_matched(group->flags, waiter->wait_mask, waiter->wait_all);
+        if (!matched) {
+            link = &waiter->next_blocked;
+            continue;
+        }
+        *link = waiter->next_blocked;
+        waiter->wait_result = matched;
+        if (waiter->wait_clear) {
+            group->flags &= ~matched;
+        }
+        wake_thread(waiter);
+    }
+    end_critical(crit);
+}
+
+void OS_ClearEvents(EventGroup* group, uint32_t flags) {
+    uint32_t crit = start_critical();
+    group->flags &= ~flags;
+    end_critical(crit);
+}
+
+uint32_t OS_WaitEvents(EventGroup* group, uint32_t mask, bool all, bool clear,
+                       uint32_t timeout) {
+    uint32_t crit = start_critical();
+    uint32_t matched = events_matched(group->flags, mask, all);
+    if (matched) {
+        if (clear) {
+            group->flags &= ~matched;
+        }
+        end_critical(crit);
+        return matched;
+    }
+    current_thread->wait_mask = mask;
+    current_thread->wait_all = all;
+    current_thread->wait_clear = clear;
+    current_thread->wait_result = 0; // stays 0 if we time out
+    block_current_thread(&group->blocked_head, 0);
+    if (timeout) {
+        start_sleeping(timeout);
+    }
+    remove_current_thread();
+    end_critical(crit); // the context switch happens here
+    return current_thread->wait_result;
+}
+
 static uint32_t thread_uuid = 1;
-bool OS_AddThread(void (*task)(void), const char* name, uint32_t stack_size,
-                  uint32_t priority) {
+static uint32_t add_thread(void (*task)(void), const char* name,
+                           uint32_t stack_size, uint32_t priority,
+                           RTParams* rt) {
     uint32_t crit = start_critical();
-    if (thread_count >= MAX_THREADS - 1) {
+    if (thread_count >= MAX_THREADS) {
         end_critical(crit);
-        return false;
+        return 0;
     }
-    ++thread_count;
     uint8_t thread_index = 0;
     while (threads[thread_index].alive) { thread_index++; }
     TCB* adding = &threads[thread_index];
 
+    // initialize stack
+    stack_size = max(stack_size, MIN_STACK_SIZE) + 32; // extra is for MPU
+    adding->stack = malloc(stack_size);
+    if (!adding->stack) {
+        end_critical(crit);
+        return 0;
+    }
+    ++thread_count;
+
     if ((adding->parent_process = current_thread->parent_process)) {
         ++adding->parent_process->threads;
     }
     adding->alive = true;
     adding->asleep = false;
+    adding->blocked = false;
     adding->sleep_time = 0;
     adding->priority = priority;
     adding->id = thread_uuid++;
     adding->name = name;
     adding->next_tcb = adding->prev_tcb = &idle;
     adding->out_device = UART;
+    adding->esp_link = 0;
+    adding->exit_code = 0;
+    adding->rt = rt;
+    OS_InitSemaphore(&adding->exited, -1);
 
-    // initialize stack
-    stack_size = max(stack_size, MIN_STACK_SIZE) + 32; // extra is for MPU
-    adding->stack = malloc(stack_size);
-    if (!adding->stack) {
-        return false;
-    }
     adding->sp = &adding->stack[stack_size / 4 - 1];
     // TODO: check if 8 byte stack alignment matters
     adding->sp = (uint32_t*)((uint8_t*)adding->sp - (uint32_t)adding->sp % 8);
@@ -243,9 +467,81 @@ bool OS_AddThread(void (*task)(void), const char* name, uint32_t stack_size,
     }
     adding->sp -= 13; // Space for R0-R12
 
+    TRACE(TRACE_THREAD, adding->id, adding->name);
     insert_thread(adding);
     end_critical(crit);
-    return true;
+    return adding->id;
+}
+
+uint32_t OS_AddThread(void (*task)(void), const char* name,
+                      uint32_t stack_size, uint32_t priority) {
+    return add_thread(task, name, stack_size, priority, 0);
+}
+
+static float realtime_density;
+
+static void realtime_thread(void) {
+    RTParams* rt = current_thread->rt;
+    rt->release = OS_Time();
+    rt->deadline = rt->release + rt->relative_deadline;
+    while (true) {
+        rt->job_time = 0;
+        rt->task();
+        uint32_t crit = start_critical();
+        uint32_t now = OS_Time();
+        ++rt->jobs;
+        if ((int32_t)(now - rt->deadline) > 0) {
+            ++rt->deadline_misses;
+        }
+        if (rt->job_time > rt->budget) {
+            ++rt->budget_overruns;
+        }
+        // releases are tracked in absolute time so they don't drift
+        rt->release += rt->period;
+        if ((int32_t)(rt->release - now) > (int32_t)rt->period) {
+            rt->release = now; // OS time was reset
+        }
+        rt->deadline = rt->release + rt->relative_deadline;
+        if ((int32_t)(rt->release - now) > 0) {
+            OS_Sleep(rt->release - now);
+        } else {
+            // we're behind, so start the next job right away but let
+            // anything with an earlier deadline go first
+            reschedule_current_thread();
+        }
+        end_critical(crit);
+    }
+}
+
+uint32_t OS_AddRealtimeThread(void (*task)(void), const char* name,
+                              uint32_t stack_size, uint32_t period,
+                              uint32_t deadline, uint32_t budget) {
+    if (!period || !deadline || budget > min(period, deadline)) {
+        return 0;
+    }
+    RTParams* rt = calloc(sizeof(RTParams));
+    if (!rt) {
+        return 0;
+    }
+    rt->task = task;
+    rt->period = period;
+    rt->relative_deadline = deadline;
+    rt->budget = budget;
+    rt->density = (float)budget / min(period, deadline);
+    rt->deadline = (os_running ? OS_Time() : 0) + deadline;
+
+    uint32_t crit = start_critical();
+    // EDF can meet every deadline as long as total density is at most 1
+    uint32_t id = 0;
+    if (realtime_density + rt->density <= 1 &&
+        (id = add_thread(realtime_thread, name, stack_size, 0, rt))) {
+        realtime_density += rt->density;
+    }
+    end_critical(crit);
+    if (!id) {
+        free(rt);
+    }
+    return id;
 }
 
 bool OS_AddProcess(void (*entry)(void), void* text, void* data,
@@ -279,120 +575,278 @@ uint32_t OS_Id(void) {
 
 // performance measurments for periodic tasks
 #ifdef TRACK_JITTER
-static int32_t max_jitter;
-static uint32_t jitter_histogram[128] = {0};
+// Jitter (in microseconds) is bucketed on a log scale: values under 8 get
+// their own bucket, and above that each power of 2 is split into 4 buckets
+#define JITTER_BUCKETS 64
+typedef struct {
+    uint32_t generation; // stats are cleared when this falls behind
+    uint32_t count;
+    uint32_t max;
+    uint32_t buckets[JITTER_BUCKETS];
+} JitterStats;
+
+static volatile uint32_t jitter_generation;
+
+static uint8_t jitter_bucket(uint32_t jitter) {
+    if (jitter < 8) {
+        return jitter;
+    }
+    uint8_t octave = 31 - __builtin_clz(jitter);
+    uint8_t bucket = 4 * (octave - 1) + ((jitter >> (octave - 2)) & 3);
+    return min(bucket, JITTER_BUCKETS - 1);
+}
+
+static uint32_t jitter_bucket_min(uint8_t bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    return (4 + bucket % 4) << (bucket / 4 - 1);
+}
+
+// largest jitter that lands in a bucket
+static uint32_t jitter_bucket_max(uint8_t bucket) {
+    return bucket < 8 ? bucket : jitter_bucket_min(bucket + 1) - 1;
+}
+
+// only ever called from the periodic task interrupt, so each task's stats
+// have a single writer and readers never need to block it
+static void jitter_record(JitterStats* stats, uint32_t jitter) {
+    if (stats->generation != jitter_generation) {
+        memset(stats, 0, sizeof(JitterStats));
+        stats->generation = jitter_generation;
+    }
+    ++stats->count;
+    stats->max = max(stats->max, jitter);
+    ++stats->buckets[jitter_bucket(jitter)];
+}
+
+// upper bound of the bucket containing the given fraction (out of 1000) of
+// all recorded releases
+static uint32_t jitter_percentile(const JitterStats* stats,
+                                  uint32_t per_mille) {
+    uint64_t target = (uint64_t)stats->count * per_mille;
+    uint64_t seen = 0;
+    for (int i = 0; i < JITTER_BUCKETS; ++i) {
+        seen += stats->buckets[i];
+        if (seen * 1000 >= target) {
+            // the last bucket also holds everything too big for the others
+            return i == JITTER_BUCKETS - 1
+                       ? stats->max
+                       : min(jitter_bucket_max(i), stats->max);
+        }
+    }
+    return stats->max;
+}
 #endif
 
-typedef struct ptask {
+typedef struct {
     void (*task)(void);
-    struct ptask* next;
-    uint32_t reload;
-    uint32_t current;
-    uint32_t last;
+    uint64_t release; // absolute time of the next release
+    uint32_t period;
+    uint32_t id;
     uint8_t priority;
+    uint8_t heap_idx;
+#ifdef TRACK_JITTER
+    JitterStats jitter;
+#endif
 } PTask;
 
-#define MAX_PTASKS 4
-static PTask ptasks[MAX_PTASKS];
+// Periodic tasks are kept in a min-heap ordered by their next release time so
+// that the timer only needs to interrupt once for each release
+#define MAX_PTASKS 32
+static PTask* ptask_heap[MAX_PTASKS];
 static uint8_t num_ptasks;
-static PTask* current_ptask;
+static uint32_t ptask_uuid = 1;
 
-static void setup_next_ptask(uint32_t lag);
+// whether a should be released before b
+static bool ptask_before(const PTask* a, const PTask* b) {
+    return a->release < b->release ||
+           (a->release == b->release && a->priority < b->priority);
+}
 
-static void ptask_insert(PTask* task) {
-    if (!current_ptask) {
-        current_ptask = task;
-        task->next = 0;
-        return;
+static void ptask_place(PTask* task, uint8_t idx) {
+    ptask_heap[idx] = task;
+    task->heap_idx = idx;
+}
+
+static void ptask_sift_up(uint8_t idx) {
+    PTask* task = ptask_heap[idx];
+    while (idx) {
+        uint8_t parent = (idx - 1) / 2;
+        if (!ptask_before(task, ptask_heap[parent])) {
+            break;
+        }
+        ptask_place(ptask_heap[parent], idx);
+        idx = parent;
+    }
+    ptask_place(task, idx);
+}
+
+static void ptask_sift_down(uint8_t idx) {
+    PTask* task = ptask_heap[idx];
+    while (true) {
+        uint8_t child = idx * 2 + 1;
+        if (child >= num_ptasks) {
+            break;
+        }
+        if (child + 1 < num_ptasks &&
+            ptask_before(ptask_heap[child + 1], ptask_heap[child])) {
+            ++child;
+        }
+        if (!ptask_before(ptask_heap[child], task)) {
+            break;
+        }
+        ptask_place(ptask_heap[child], idx);
+        idx = child;
     }
-    if (task->priority < current_ptask->priority) {
-        task->next = current_ptask;
-        current_ptask = task;
+    ptask_place(task, idx);
+}
+
+static PTask* ptask_find(uint32_t id) {
+    for (int i = 0; i < num_ptasks; ++i) {
+        if (ptask_heap[i]->id == id) {
+            return ptask_heap[i];
+        }
     }
-    PTask* temp = current_ptask;
-    while (temp->next && task->priority > temp->next->priority) {
-        temp = temp->next;
+    return 0;
+}
+
+// set the oneshot timer to go off at the earliest release
+static void ptask_arm_timer(void) {
+    if (!os_running) {
+        return; // OS_Launch arms the timer once time starts
+    }
+    if (!num_ptasks) {
+        timer_stop(2);
+        return;
     }
-    task->next = temp->next;
-    temp->next = task;
+    int64_t delay = ptask_heap[0]->release - OS_Time64();
+    // releases further out than the timer can count wake up early and re-arm
+    timer_restart(2, delay < 1 ? 1 : delay > UINT32_MAX ? UINT32_MAX : delay);
 }
 
 static void periodic_task(void) {
-    uint32_t time = OS_Time();
-    do {
-        uint32_t current = OS_Time();
+    uint64_t now = OS_Time64();
+    // re-reading the time lets releases that come due while running earlier
+    // tasks share this interrupt
+    while (num_ptasks && ptask_heap[0]->release <= now) {
+        PTask* current = ptask_heap[0];
 #ifdef TRACK_JITTER
-        uint32_t jitter = to_us(
-            difference(current - current_ptask->last, current_ptask->reload));
-        max_jitter = max(max_jitter, jitter);
-        uint8_t idx = min(
-            sizeof(jitter_histogram) / sizeof(jitter_histogram[0]) - 1, jitter);
-        ++jitter_histogram[idx];
+        jitter_record(&current->jitter, to_us(now - current->release));
 #endif
-        current_ptask->last = current;
-        current_ptask->task();
-    } while ((current_ptask = current_ptask->next));
-    setup_next_ptask(OS_Time() - time);
+        current->release += current->period;
+        if (current->release <= now) {
+            current->release = now + current->period; // drop missed releases
+        }
+        ptask_sift_down(0);
+        current->task();
+        now = OS_Time64();
+    }
+    ptask_arm_timer();
 }
 
-static void setup_next_ptask(uint32_t lag) {
-    int32_t min_time = INT32_MAX;
-    for (int i = 0; i < num_ptasks; ++i) {
-        min_time = min(min_time, ptasks[i].current);
+uint32_t OS_AddPeriodicThread(void (*task)(void), uint32_t period,
+                              uint32_t priority) {
+    if (!period) {
+        return 0;
     }
-    uint32_t threshold = max(min_time, lag);
-    for (int i = 0; i < num_ptasks; ++i) {
-        if (ptasks[i].current <= threshold) {
-            ptask_insert(&ptasks[i]);
-            ptasks[i].current =
-                max(0, ptasks[i].reload - (threshold - ptasks[i].current));
-        } else {
-            ptasks[i].current -= threshold;
-        }
+    PTask* adding = calloc(sizeof(PTask));
+    if (!adding) {
+        return 0;
     }
-    timer_enable(2, max(min_time - lag, 1), periodic_task, 1, false);
+    uint32_t crit = start_critical();
+    if (num_ptasks >= MAX_PTASKS) {
+        end_critical(crit);
+        free(adding);
+        return 0;
+    }
+    adding->task = task;
+    adding->period = period;
+    adding->priority = priority;
+    adding->id = ptask_uuid++;
+    adding->release = (os_running ? OS_Time64() : 0) + period;
+#ifdef TRACK_JITTER
+    adding->jitter.generation = jitter_generation;
+#endif
+    ptask_place(adding, num_ptasks++);
+    ptask_sift_up(adding->heap_idx);
+    if (ptask_heap[0] == adding) {
+        ptask_arm_timer();
+    }
+    end_critical(crit);
+    return adding->id;
 }
 
-bool OS_AddPeriodicThread(void (*task)(void), uint32_t period,
-                          uint32_t priority) {
-    if (num_ptasks >= MAX_PTASKS - 1) {
+bool OS_RemovePeriodicThread(uint32_t id) {
+    uint32_t crit = start_critical();
+    PTask* removing = ptask_find(id);
+    if (!removing) {
+        end_critical(crit);
         return false;
     }
-    PTask* current = &ptasks[num_ptasks++];
-    current->priority = priority;
-    current->task = task;
-    current->last = os_running ? OS_Time() : 0;
-    current->current = current->reload = period;
-    // if the first periodic task is added after the OS starts, the oneshot
-    // timer isn't running yet
-    if (num_ptasks == 1 && os_running) {
-        setup_next_ptask(0);
+    uint8_t idx = removing->heap_idx;
+    PTask* last = ptask_heap[--num_ptasks];
+    if (last != removing) {
+        ptask_place(last, idx);
+        ptask_sift_up(idx);
+        ptask_sift_down(last->heap_idx);
     }
+    if (!idx) {
+        ptask_arm_timer();
+    }
+    end_critical(crit);
+    free(removing);
+    return true;
+}
+
+bool OS_SetPeriodicThreadPeriod(uint32_t id, uint32_t period) {
+    if (!period) {
+        return false;
+    }
+    uint32_t crit = start_critical();
+    PTask* changing = ptask_find(id);
+    if (!changing) {
+        end_critical(crit);
+        return false;
+    }
+    // keep the previous release as the phase reference
+    changing->release += (int64_t)period - changing->period;
+    changing->period = period;
+    ptask_sift_up(changing->heap_idx);
+    ptask_sift_down(changing->heap_idx);
+    ptask_arm_timer();
+    end_critical(crit);
     return true;
 }
 
 static void (*sw1task)(void);
 static void (*sw2task)(void);
 
+static void run_sw_task(void* task) {
+    ((void (*)(void))task)();
+}
+
 const uint32_t debounce_ms = 20;
 static uint32_t last_sw1;
 static uint32_t last_sw2;
 
 void gpio_portf_handler(void) {
+    TRACE_ISR_ENTER();
     uint32_t now = to_ms(OS_Time());
     if (HWREG(GPIO_PORTF_BASE + GPIO_O_RIS) & 0x01) {
         if (sw1task && now - last_sw1 > debounce_ms) {
-            sw1task();
+            OS_Defer(run_sw_task, sw1task);
         }
         last_sw1 = now;
     }
     if (HWREG(GPIO_PORTF_BASE + GPIO_O_RIS) & 0x10) {
         if (sw2task && now - last_sw2 > debounce_ms) {
-            sw2task();
+            OS_Defer(run_sw_task, sw2task);
         }
         last_sw2 = now;
     }
     HWREG(GPIO_PORTF_BASE + GPIO_O_ICR) = 0x11;
+    TRACE_ISR_EXIT();
 }
 
 void OS_AddSW1Task(void (*task)(void)) {
@@ -410,8 +864,15 @@ static void sleep_task(void) {
         if (threads[i].asleep) {
             if (threads[i].sleep_time <= reload) {
                 threads[i].sleep_time = 0;
-                threads[i].asleep = false;
-                insert_thread(&threads[i]);
+                if (threads[i].blocked) { // a timed wait ran out
+                    TRACE(TRACE_TIMEOUT, threads[i].id, 0);
+                    unlink_blocked_thread(&threads[i]);
+                    if (threads[i].blocked_count) {
+                        (*threads[i].blocked_count)++;
+                    }
+                    threads[i].wait_result = 0;
+                }
+                wake_thread(&threads[i]);
             } else {
                 threads[i].sleep_time -= reload;
             }
@@ -421,18 +882,34 @@ static void sleep_task(void) {
 
 void OS_Sleep(uint32_t time) {
     uint32_t crit = start_critical();
-    current_thread->asleep = true;
-    current_thread->sleep_time =
-        time + get_timer_reload(1) - get_timer_value(1);
+    TRACE(TRACE_SLEEP, current_thread->id, time);
+    start_sleeping(time);
     remove_current_thread();
     end_critical(crit);
 }
 
 void OS_Kill(void) {
+    OS_Exit(0);
+}
+
+void OS_Exit(int32_t exit_code) {
     uint32_t crit = start_critical();
+    // wake joiners while we're still in the run queue so they get scheduled
+    // relative to a live thread
+    TRACE(TRACE_EXIT, current_thread->id, 0);
+    current_thread->exit_code = exit_code;
+    while (current_thread->exited.blocked_head) {
+        current_thread->exited.blocked_head->join_result = exit_code;
+        OS_Signal((Sema4*)&current_thread->exited);
+    }
     --thread_count;
     current_thread->alive = false;
     free(current_thread->stack);
+    if (current_thread->rt) {
+        realtime_density -= current_thread->rt->density;
+        free(current_thread->rt);
+        current_thread->rt = 0;
+    }
     remove_current_thread();
     // Handle process cleanup if needed
     if (current_thread->parent_process) {
@@ -446,8 +923,50 @@ void OS_Kill(void) {
     end_critical(crit);
 }
 
+bool OS_Join(uint32_t id, int32_t* exit_code) {
+    uint32_t crit = start_critical();
+    TCB* joining = 0;
+    for (int i = 0; i < MAX_THREADS; ++i) {
+        if (threads[i].id == id) {
+            joining = &threads[i];
+            break;
+        }
+    }
+    if (!id || !joining || joining == current_thread) {
+        end_critical(crit);
+        return false;
+    }
+    if (!joining->alive) {
+        // already exited, but the slot hasn't been reused yet
+        if (exit_code) {
+            *exit_code = joining->exit_code;
+        }
+        end_critical(crit);
+        return true;
+    }
+    OS_Wait(&joining->exited);
+    end_critical(crit); // the context switch happens here
+    if (exit_code) {
+        *exit_code = current_thread->join_result;
+    }
+    return true;
+}
+
 // Called from within the context switch to change which stack the MPU protects
 void mpu_swap_region(void) {
+    // charge realtime threads for the cpu time they use
+    static TCB* last_thread = &idle;
+    static uint32_t last_switch;
+    if (last_thread->rt || current_thread->rt) {
+        uint32_t now = OS_Time();
+        if (last_thread->rt) {
+            last_thread->rt->job_time += now - last_switch;
+        }
+        last_switch = now;
+    }
+    last_thread = (TCB*)current_thread;
+    TRACE(TRACE_SWITCH, current_thread->id, current_thread->priority);
+
     uint32_t temp = (uint32_t)current_thread->stack;
     // 32 byte alignment required for MPU regions
     if (temp % 32) {
@@ -463,17 +982,34 @@ void OS_Suspend(void) {
 }
 
 void OS_ClearTime(void) {
-    ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_WTIMER5);
-    ROM_TimerConfigure(WTIMER5_BASE, TIMER_CFG_PERIODIC_UP);
-    ROM_TimerControlStall(WTIMER5_BASE, TIMER_A, true);
-    ROM_TimerEnable(WTIMER5_BASE, TIMER_A);
+    uint32_t crit = start_critical();
+    uint64_t elapsed = 0;
+    if (os_running) {
+        elapsed = OS_Time64();
+    } else {
+        ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_WTIMER5);
+        ROM_TimerConfigure(WTIMER5_BASE, TIMER_CFG_PERIODIC_UP);
+        ROM_TimerControlStall(WTIMER5_BASE, TIMER_A, true);
+        ROM_TimerEnable(WTIMER5_BASE, TIMER_A);
+    }
     HWREG(WTIMER5_BASE + TIMER_O_TAV) = 0;
+    HWREG(WTIMER5_BASE + TIMER_O_TBV) = 0;
+    // keep periodic tasks on the same schedule relative to the new epoch
+    for (int i = 0; i < num_ptasks; ++i) {
+        PTask* task = ptask_heap[i];
+        task->release = task->release > elapsed ? task->release - elapsed : 0;
+    }
+    end_critical(crit);
 }
 
 uint32_t OS_Time(void) {
     return ROM_TimerValueGet(WTIMER5_BASE, TIMER_A);
 }
 
+uint64_t OS_Time64(void) {
+    return ROM_TimerValueGet64(WTIMER5_BASE);
+}
+
 noreturn void OS_Launch(uint32_t time_slice) {
     ROM_MPUEnable(MPU_CONFIG_PRIV_DEFAULT);
     ROM_IntEnable(FAULT_MPU);
@@ -483,10 +1019,10 @@ noreturn void OS_Launch(uint32_t time_slice) {
     ROM_SysTickIntEnable();
     ROM_SysTickEnable();
     timer_enable(1, ms(1), &sleep_task, 3, true);
-    if (num_ptasks) {
-        setup_next_ptask(0);
-    }
     OS_ClearTime();
+    os_running = true;
+    timer_enable(2, UINT32_MAX, periodic_task, 1, false);
+    ptask_arm_timer();
     idle_task();
 }
 
@@ -494,29 +1030,87 @@ void systick_handler() {
     ROM_IntPendSet(FAULT_PENDSV);
 }
 
+#ifdef TRACK_JITTER
+// copy a periodic task's info out from under the dispatcher
+static bool jitter_snapshot(uint8_t idx, PTask* out) {
+    uint32_t crit = start_critical();
+    bool found = idx < num_ptasks;
+    if (found) {
+        memcpy(out, ptask_heap[idx], sizeof(PTask));
+    }
+    end_critical(crit);
+    if (found && out->jitter.generation != jitter_generation) {
+        memset(&out->jitter, 0, sizeof(JitterStats)); // reset is pending
+    }
+    return found;
+}
+#endif
+
 void OS_ReportJitter(void) {
 #ifdef TRACK_JITTER
-    printf("Max Jitter: %d microseconds\n\r", max_jitter);
-    uint32_t most = 0, most_idx;
-    uint32_t sum = 0;
-    uint32_t total_num = 0;
-    for (int i = 0; i < sizeof(jitter_histogram) / sizeof(jitter_histogram[0]);
-         ++i) {
-        uint32_t num = jitter_histogram[i];
-        sum += i * num;
-        total_num += num;
-        if (num > most) {
-            most = num;
-            most_idx = i;
+    PTask task;
+    printf("%-6s%-12s%-12s%-10s%-8s%-8s%-8s%-8s\n\r", "Id", "Task",
+           "Period(us)", "Releases", "p50", "p99", "p999", "Max");
+    for (int i = 0; jitter_snapshot(i, &task); ++i) {
+        JitterStats* stats = &task.jitter;
+        printf("%-6d0x%08x  %-12d%-10d", task.id, (uint32_t)task.task,
+               to_us(task.period), stats->count);
+        if (!stats->count) {
+            printf("no releases yet\n\r");
+            continue;
         }
+        printf("%-8d%-8d%-8d%-8d\n\r", jitter_percentile(stats, 500),
+               jitter_percentile(stats, 990), jitter_percentile(stats, 999),
+               stats->max);
     }
-    printf("Modal Jitter: %d microseconds\n\r", most_idx);
-    printf("Average Jitter: %d microseconds\n\r", sum / total_num);
+    puts("Jitter is in microseconds (percentiles are bucket upper bounds)");
 #else
     puts("Jitter tracking not enabled...");
 #endif
 }
 
+void OS_DumpJitter(void) {
+#ifdef TRACK_JITTER
+    // one line per task followed by one line per non-empty bucket:
+    // task,ID,PERIOD_US,COUNT,MAX_US,P50_US,P99_US,P999_US
+    // bucket,ID,MIN_US,MAX_US,COUNT
+    PTask task;
+    for (int i = 0; jitter_snapshot(i, &task); ++i) {
+        JitterStats* stats = &task.jitter;
+        printf("task,%d,%d,%d,%d,%d,%d,%d\n\r", task.id, to_us(task.period),
+               stats->count, stats->max, jitter_percentile(stats, 500),
+               jitter_percentile(stats, 990), jitter_percentile(stats, 999));
+        for (int b = 0; b < JITTER_BUCKETS; ++b) {
+            if (stats->buckets[b]) {
+                printf("bucket,%d,%d,%d,%d\n\r", task.id,
+                       jitter_bucket_min(b), jitter_bucket_max(b),
+                       stats->buckets[b]);
+            }
+        }
+    }
+#endif
+}
+
+void OS_ResetJitter(void) {
+#ifdef TRACK_JITTER
+    ++jitter_generation; // each task clears itself at its next release
+#endif
+}
+
+void OS_ReportRealtime(void) {
+    printf("%-24s%-12s%-10s%-10s%-10s\n\r", "Thread", "Period(us)", "Jobs",
+           "Misses", "Overruns");
+    for (int i = 0; i < MAX_THREADS; ++i) {
+        RTParams* rt = threads[i].rt;
+        if (threads[i].alive && rt) {
+            printf("%-24s%-12d%-10d%-10d%-10d\n\r", threads[i].name,
+                   to_us(rt->period), rt->jobs, rt->deadline_misses,
+                   rt->budget_overruns);
+        }
+    }
+    printf("Utilization: %d%%\n\r", (int32_t)(realtime_density * 100));
+}
+
 // TODO: change the stack pointer so that using the stack in this handler
 // doesn't overwrite the HeapNode for the stack that just overflowed
 void memory_management_fault_handler(void) {
@@ -574,13 +1168,21 @@ void OS_RedirectOutput(OutputDevice device) {
     current_thread->out_device = device;
 }
 
+void OS_RedirectLink(uint8_t link) {
+    current_thread->esp_link = link;
+}
+
+uint8_t OS_Link(void) {
+    return current_thread->esp_link;
+}
+
 void OS_RedirectString(const char* str) {
     if (current_thread->out_device & UART) {
         uart_puts(str);
     }
     if (current_thread->out_device & ESP) {
-        ESP8266_Send(str);
-        ESP8266_Send("\n\r");
+        ESP8266_Write(str, strlen(str));
+        ESP8266_Write("\n\r", 2);
     }
     if (current_thread->out_device & FS) {
         // TODO: write to open file
@@ -590,13 +1192,27 @@ void OS_RedirectString(const char* str) {
     }
 }
 
+void OS_RedirectWrite(const char* buf, uint32_t len) {
+    if (current_thread->out_device & UART) {
+        uart_write(buf, len);
+    }
+    if (current_thread->out_device & ESP) {
+        ESP8266_Write(buf, len);
+    }
+    if (current_thread->out_device & FS) {
+        // TODO: write to open file
+    }
+    if (current_thread->out_device & SCREEN) {
+        while (len--) { lcd_putchar(*buf++); }
+    }
+}
+
 void OS_RedirectChar(char c) {
-    char buf[2] = {c, '\0'};
     if (current_thread->out_device & UART) {
         uart_putchar(c);
     }
     if (current_thread->out_device & ESP) {
-        ESP8266_Send(buf);
+        ESP8266_Write(&c, 1);
     }
     if (current_thread->out_device & FS) {
         // TODO: write to open file
@@ -0,0 +1,432 @@
+#include "dsp.h"
+#include "fastmath.h"
+#include "heap.h"
+#include "std.h"
+#include <stdint.h>
+
+// Thin wrappers so the SIMD instructions can be used from C
+#ifdef __ARM_FEATURE_DSP
+
+// (x.lo * y.lo + x.hi * y.hi) + acc
+static inline int64_t smlald(uint32_t x, uint32_t y, int64_t acc) {
+    __asm("smlald %Q0, %R0, %1, %2" : "+r"(acc) : "r"(x), "r"(y));
+    return acc;
+}
+
+// x.lo * y.lo - x.hi * y.hi
+static inline int32_t smusd(uint32_t x, uint32_t y) {
+    int32_t result;
+    __asm("smusd %0, %1, %2" : "=r"(result) : "r"(x), "r"(y));
+    return result;
+}
+
+// x.lo * y.hi + x.hi * y.lo
+static inline int32_t smuadx(uint32_t x, uint32_t y) {
+    int32_t result;
+    __asm("smuadx %0, %1, %2" : "=r"(result) : "r"(x), "r"(y));
+    return result;
+}
+
+// saturating add of both halves
+static inline uint32_t qadd16(uint32_t x, uint32_t y) {
+    uint32_t result;
+    __asm("qadd16 %0, %1, %2" : "=r"(result) : "r"(x), "r"(y));
+    return result;
+}
+
+// halving add and subtract of both halves
+static inline uint32_t shadd16(uint32_t x, uint32_t y) {
+    uint32_t result;
+    __asm("shadd16 %0, %1, %2" : "=r"(result) : "r"(x), "r"(y));
+    return result;
+}
+
+static inline uint32_t shsub16(uint32_t x, uint32_t y) {
+    uint32_t result;
+    __asm("shsub16 %0, %1, %2" : "=r"(result) : "r"(x), "r"(y));
+    return result;
+}
+
+#else
+// The same instructions in plain C, for the host build in test/
+
+static inline int32_t lo(uint32_t x) {
+    return (int16_t)x;
+}
+
+static inline int32_t hi(uint32_t x) {
+    return (int16_t)(x >> 16);
+}
+
+static inline uint32_t halves(int32_t l, int32_t h) {
+    return (uint16_t)l | (uint32_t)(uint16_t)h << 16;
+}
+
+static inline int32_t clamp16(int32_t x) {
+    return x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x;
+}
+
+static inline int64_t smlald(uint32_t x, uint32_t y, int64_t acc) {
+    return acc + lo(x) * lo(y) + (int64_t)(hi(x) * hi(y));
+}
+
+// the 32 bit results wrap the same way the instructions' do
+static inline int32_t smusd(uint32_t x, uint32_t y) {
+    return (uint32_t)(lo(x) * lo(y)) - (uint32_t)(hi(x) * hi(y));
+}
+
+static inline int32_t smuadx(uint32_t x, uint32_t y) {
+    return (uint32_t)(lo(x) * hi(y)) + (uint32_t)(hi(x) * lo(y));
+}
+
+static inline uint32_t qadd16(uint32_t x, uint32_t y) {
+    return halves(clamp16(lo(x) + lo(y)), clamp16(hi(x) + hi(y)));
+}
+
+static inline uint32_t shadd16(uint32_t x, uint32_t y) {
+    return halves((lo(x) + lo(y)) >> 1, (hi(x) + hi(y)) >> 1);
+}
+
+static inline uint32_t shsub16(uint32_t x, uint32_t y) {
+    return halves((lo(x) - lo(y)) >> 1, (hi(x) - hi(y)) >> 1);
+}
+#endif
+
+static inline q15_t sat_q15(int32_t x) {
+    return x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x;
+}
+
+static inline q31_t sat_q31(int64_t x) {
+    return x > INT32_MAX ? INT32_MAX : x < INT32_MIN ? INT32_MIN : x;
+}
+
+// the M4 allows unaligned word loads, so any pair of q15s can be read at once
+static inline uint32_t load_pair(const q15_t* p) {
+    uint32_t pair;
+    __builtin_memcpy(&pair, p, sizeof(pair));
+    return pair;
+}
+
+static inline void store_pair(q15_t* p, uint32_t pair) {
+    __builtin_memcpy(p, &pair, sizeof(pair));
+}
+
+static inline uint32_t pack(q15_t lo, q15_t hi) {
+    return (uint16_t)lo | (uint32_t)hi << 16;
+}
+
+void adc_to_q15(const uint16_t* in, q15_t* out, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 1 < n; i += 2) {
+        // 12 bit samples can be shifted up without crossing into the other
+        // half, then flipping the top bit subtracts 0x8000 from both
+        uint32_t pair = load_pair((const q15_t*)&in[i]);
+        store_pair(&out[i], (pair << 4) ^ 0x80008000);
+    }
+    if (i < n) {
+        out[i] = (in[i] << 4) - 0x8000;
+    }
+}
+
+void q15_add(const q15_t* a, const q15_t* b, q15_t* out, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 1 < n; i += 2) {
+        store_pair(&out[i], qadd16(load_pair(&a[i]), load_pair(&b[i])));
+    }
+    if (i < n) {
+        out[i] = sat_q15(a[i] + b[i]);
+    }
+}
+
+void q15_stats(const q15_t* in, uint32_t n, q15_t* rms, q15_t* peak) {
+    int64_t squares = 0;
+    int32_t largest = 0;
+    uint32_t i = 0;
+    for (; i + 1 < n; i += 2) {
+        uint32_t pair = load_pair(&in[i]);
+        squares = smlald(pair, pair, squares);
+    }
+    if (i < n) {
+        squares += in[i] * in[i];
+    }
+    for (i = 0; i < n; i++) {
+        int32_t magnitude = in[i] < 0 ? -in[i] : in[i];
+        if (magnitude > largest) {
+            largest = magnitude;
+        }
+    }
+    if (rms) {
+        // the mean is at most 2^30, so it fits in 32 bits
+        *rms = n ? sat_q15(isqrt(udiv64(squares, n))) : 0;
+    }
+    if (peak) {
+        *peak = sat_q15(largest);
+    }
+}
+
+FIRQ15* fir_q15_new(const q15_t* coeffs, uint16_t taps) {
+    if (!taps || taps & 1) {
+        return 0;
+    }
+    FIRQ15* fir = calloc(sizeof(FIRQ15));
+    if (!fir) {
+        return 0;
+    }
+    fir->state = calloc(2 * taps * sizeof(q15_t));
+    if (!fir->state) {
+        free(fir);
+        return 0;
+    }
+    fir->coeffs = coeffs;
+    fir->taps = taps;
+    return fir;
+}
+
+FIRQ31* fir_q31_new(const q31_t* coeffs, uint16_t taps) {
+    if (!taps) {
+        return 0;
+    }
+    FIRQ31* fir = calloc(sizeof(FIRQ31));
+    if (!fir) {
+        return 0;
+    }
+    fir->state = calloc(2 * taps * sizeof(q31_t));
+    if (!fir->state) {
+        free(fir);
+        return 0;
+    }
+    fir->coeffs = coeffs;
+    fir->taps = taps;
+    return fir;
+}
+
+void fir_q15_free(FIRQ15* fir) {
+    free(fir->state);
+    free(fir);
+}
+
+void fir_q31_free(FIRQ31* fir) {
+    free(fir->state);
+    free(fir);
+}
+
+// The window is stored newest sample first and written to both halves of the
+// state so that state[idx..idx+taps) is always the whole window in order
+static inline void fir_q15_push(FIRQ15* fir, q15_t x) {
+    fir->idx = (fir->idx ? fir->idx : fir->taps) - 1;
+    fir->state[fir->idx] = fir->state[fir->idx + fir->taps] = x;
+}
+
+static inline q15_t fir_q15_output(FIRQ15* fir) {
+    const q15_t* window = &fir->state[fir->idx];
+    int64_t acc = 0;
+    for (uint16_t k = 0; k < fir->taps; k += 2) {
+        acc = smlald(load_pair(&fir->coeffs[k]), load_pair(&window[k]), acc);
+    }
+    return sat_q15(acc >> 15);
+}
+
+void fir_q15(FIRQ15* fir, const q15_t* in, q15_t* out, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        fir_q15_push(fir, in[i]);
+        out[i] = fir_q15_output(fir);
+    }
+}
+
+uint32_t fir_q15_decimate(FIRQ15* fir, const q15_t* in, q15_t* out,
+                          uint32_t n, uint16_t factor) {
+    uint32_t written = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        fir_q15_push(fir, in[i]);
+        if (++fir->phase >= factor) {
+            fir->phase = 0;
+            out[written++] = fir_q15_output(fir);
+        }
+    }
+    return written;
+}
+
+void fir_q31(FIRQ31* fir, const q31_t* in, q31_t* out, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        fir->idx = (fir->idx ? fir->idx : fir->taps) - 1;
+        fir->state[fir->idx] = fir->state[fir->idx + fir->taps] = in[i];
+        const q31_t* window = &fir->state[fir->idx];
+        int64_t acc = 0;
+        for (uint16_t k = 0; k < fir->taps; k++) {
+            acc += (int64_t)fir->coeffs[k] * window[k];
+        }
+        out[i] = sat_q31(acc >> 31);
+    }
+}
+
+BiquadQ15* biquad_q15_new(const int16_t (*coeffs)[5], uint8_t stages) {
+    for (uint8_t s = 0; s < stages; s++) {
+        if (coeffs[s][3] == INT16_MIN) { // -a1 has to fit in 16 bits
+            return 0;
+        }
+    }
+    BiquadQ15* iir = calloc(sizeof(BiquadQ15));
+    if (!iir) {
+        return 0;
+    }
+    iir->state = calloc(stages * sizeof(*iir->state));
+    if (!iir->state) {
+        free(iir);
+        return 0;
+    }
+    iir->coeffs = coeffs;
+    iir->stages = stages;
+    return iir;
+}
+
+BiquadQ31* biquad_q31_new(const int32_t (*coeffs)[5], uint8_t stages) {
+    BiquadQ31* iir = calloc(sizeof(BiquadQ31));
+    if (!iir) {
+        return 0;
+    }
+    iir->state = calloc(stages * sizeof(*iir->state));
+    if (!iir->state) {
+        free(iir);
+        return 0;
+    }
+    iir->coeffs = coeffs;
+    iir->stages = stages;
+    return iir;
+}
+
+void biquad_q15_free(BiquadQ15* iir) {
+    free(iir->state);
+    free(iir);
+}
+
+void biquad_q31_free(BiquadQ31* iir) {
+    free(iir->state);
+    free(iir);
+}
+
+// Each stage runs over the whole block before the next one so its
+// coefficients and state stay in registers
+void biquad_q15(BiquadQ15* iir, const q15_t* in, q15_t* out, uint32_t n) {
+    for (uint8_t s = 0; s < iir->stages; s++) {
+        const int16_t* c = iir->coeffs[s];
+        q15_t* st = iir->state[s];
+        uint32_t b01 = pack(c[0], c[1]);
+        uint32_t b2_a1 = pack(c[2], -c[3]);
+        q15_t x1 = st[0], x2 = st[1], y1 = st[2], y2 = st[3];
+        for (uint32_t i = 0; i < n; i++) {
+            q15_t x = in[i];
+            int64_t acc = smlald(pack(x, x1), b01, 0);
+            acc = smlald(pack(x2, y1), b2_a1, acc);
+            acc -= c[4] * y2;
+            q15_t y = sat_q15(acc >> 14);
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            out[i] = y;
+        }
+        st[0] = x1;
+        st[1] = x2;
+        st[2] = y1;
+        st[3] = y2;
+        in = out; // later stages filter in place
+    }
+}
+
+void biquad_q31(BiquadQ31* iir, const q31_t* in, q31_t* out, uint32_t n) {
+    for (uint8_t s = 0; s < iir->stages; s++) {
+        const int32_t* c = iir->coeffs[s];
+        q31_t* st = iir->state[s];
+        q31_t x1 = st[0], x2 = st[1], y1 = st[2], y2 = st[3];
+        for (uint32_t i = 0; i < n; i++) {
+            q31_t x = in[i];
+            int64_t acc = (int64_t)c[0] * x + (int64_t)c[1] * x1 +
+                          (int64_t)c[2] * x2 - (int64_t)c[3] * y1 -
+                          (int64_t)c[4] * y2;
+            q31_t y = sat_q31(acc >> 30);
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            out[i] = y;
+        }
+        st[0] = x1;
+        st[1] = x2;
+        st[2] = y1;
+        st[3] = y2;
+        in = out;
+    }
+}
+
+MovingAverage* moving_average_new(uint16_t len) {
+    if (!len) {
+        return 0;
+    }
+    MovingAverage* avg = calloc(sizeof(MovingAverage));
+    if (!avg) {
+        return 0;
+    }
+    avg->window = calloc(len * sizeof(q15_t));
+    if (!avg->window) {
+        free(avg);
+        return 0;
+    }
+    avg->len = len;
+    return avg;
+}
+
+void moving_average_free(MovingAverage* avg) {
+    free(avg->window);
+    free(avg);
+}
+
+q15_t moving_average(MovingAverage* avg, q15_t x) {
+    avg->sum += x - avg->window[avg->idx];
+    avg->window[avg->idx] = x;
+    if (++avg->idx == avg->len) {
+        avg->idx = 0;
+    }
+    return avg->sum / avg->len;
+}
+
+void moving_average_block(MovingAverage* avg, const q15_t* in, q15_t* out,
+                          uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) { out[i] = moving_average(avg, in[i]); }
+}
+
+bool fft_q15(q15_t* data, uint16_t n) {
+    if (n < 2 || n > 1024 || n & (n - 1)) {
+        return false;
+    }
+    // reorder into bit reversed index order
+    for (uint16_t i = 1, j = 0; i < n; i++) {
+        uint16_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) { j ^= bit; }
+        j ^= bit;
+        if (i < j) {
+            uint32_t temp = load_pair(&data[2 * i]);
+            store_pair(&data[2 * i], load_pair(&data[2 * j]));
+            store_pair(&data[2 * j], temp);
+        }
+    }
+    // radix 2 butterflies, each complex value is one packed word
+    for (uint16_t len = 2; len <= n; len <<= 1) {
+        uint16_t half = len / 2;
+        uint16_t step = 65536 / len;
+        for (uint16_t k = 0; k < half; k++) {
+            uint16_t angle = k * step;
+            uint32_t w = pack(cos_q15(angle), -sin_q15(angle)); // e^-j*angle
+            for (uint16_t i = k; i < n; i += len) {
+                q15_t* a = &data[2 * i];
+                q15_t* b = &data[2 * (i + half)];
+                uint32_t bw = load_pair(b);
+                uint32_t t = pack(sat_q15(smusd(bw, w) >> 15),
+                                  sat_q15(smuadx(bw, w) >> 15));
+                uint32_t aw = load_pair(a);
+                store_pair(a, shadd16(aw, t));
+                store_pair(b, shsub16(aw, t));
+            }
+        }
+    }
+    return true;
+}
@@ -10,6 +10,7 @@
 #include "OS.h"
 #include "eDisk.h"
 #include "printf.h"
+#include "timer.h"
 #include <stdint.h>
 
 static void chip_select(void) {
@@ -92,8 +93,15 @@ static void spi_clock_fast() {
 
 static volatile DSTATUS Stat = STA_NOINIT; // Physical drive status
 
-// 1kHz decrement timer stopped at zero (disk_timerproc())
-static volatile uint32_t Timer1, Timer2;
+// Timeouts are absolute OS_Time deadlines so they keep working without a
+// periodic task counting them down
+static uint32_t deadline(uint32_t timeout_ms) {
+    return OS_Time() + ms(timeout_ms);
+}
+
+static bool expired(uint32_t deadline) {
+    return (int32_t)(OS_Time() - deadline) >= 0;
+}
 
 static uint8_t CardType; // Card type flags
 
@@ -144,12 +152,13 @@ static void xmit_spi_multi(const uint8_t* buff, uint32_t btx) {
 // returns false on timeout
 static bool wait_ready(uint32_t wt) {
     uint8_t d;
-    Timer2 = wt;
-    do {
-        d = xchg_spi(0xFF);
-        // This loop takes a time. Insert rot_rdq() here for multitask
-        // environment.
-    } while (d != 0xFF && Timer2); // Wait for card goes ready or timeout
+    uint32_t timeout = deadline(wt);
+    while ((d = xchg_spi(0xFF)) != 0xFF) { // Wait for card goes ready
+        if (expired(timeout)) {
+            break;
+        }
+        OS_Suspend(); // let other threads run while the card is busy
+    }
     return (d == 0xFF) ? 1 : 0;
 }
 
@@ -175,12 +184,10 @@ static bool select(void) {
 // returns false on timeout
 static bool rcvr_datablock(uint8_t* buff, uint32_t btr) {
     uint8_t token;
-    Timer1 = 200;
+    uint32_t timeout = deadline(200);
     do { // Wait for DataStart token in timeout of 200ms
         token = xchg_spi(0xFF);
-        /* This loop will take a time. Insert rot_rdq() here for multitask
-         * envilonment. */
-    } while ((token == 0xFF) && Timer1);
+    } while ((token == 0xFF) && !expired(timeout));
     if (token != 0xFE)
         return 0; // Function fails if invalid DataStart token or timeout
 
@@ -256,15 +263,10 @@ static uint8_t send_cmd(uint8_t cmd, uint32_t arg) {
 }
 
 DSTATUS eDisk_Init() {
-    static bool started_timerproc = false;
-    if (!started_timerproc) {
-        OS_AddPeriodicThread(&disk_timerproc, ms(1), 1);
-        started_timerproc = true;
-    }
     uint8_t n, cmd, ty, ocr[4];
 
     chip_select();
-    for (Timer1 = 10; Timer1;) {} // 10ms
+    OS_Sleep(ms(10));
 
     if (Stat & STA_NODISK)
         return Stat; // Is card existing in the socket?
@@ -274,15 +276,15 @@ DSTATUS eDisk_Init() {
 
     ty = 0;
     if (send_cmd(CMD0, 0) == 1) {         // Put the card SPI/Idle state
-        Timer1 = 1000;                    // Initialization timeout = 1 sec
+        uint32_t timeout = deadline(1000); // Initialization timeout = 1 sec
         if (send_cmd(CMD8, 0x1AA) == 1) { // SDv2?
             for (n = 0; n < 4; n++)
                 ocr[n] = xchg_spi(0xFF); // Get 32 bit return value of R7 resp
             if (ocr[2] == 0x01 &&
                 ocr[3] == 0xAA) { // Is the card supports vcc of 2.7-3.6V?
-                while (Timer1 && send_cmd(ACMD41, 1 << 30))
+                while (!expired(timeout) && send_cmd(ACMD41, 1 << 30))
                     ; // Wait for end of initialization with ACMD41(HCS)
-                if (Timer1 &&
+                if (!expired(timeout) &&
                     send_cmd(CMD58, 0) == 0) { // Check CCS bit in the OCR
                     for (n = 0; n < 4; n++) ocr[n] = xchg_spi(0xFF);
                     ty = (ocr[0] & 0x40) ? CT_SD2 | CT_BLOCK
@@ -297,9 +299,10 @@ DSTATUS eDisk_Init() {
                 ty = CT_MMC;
                 cmd = CMD1; // MMCv3 (CMD1(0))
             }
-            while (Timer1 && send_cmd(cmd, 0))
+            while (!expired(timeout) && send_cmd(cmd, 0))
                 ; // Wait for end of initialization
-            if (!Timer1 || send_cmd(CMD16, 512) != 0) // Set block length: 512
+            if (expired(timeout) ||
+                send_cmd(CMD16, 512) != 0) // Set block length: 512
                 ty = 0;
         }
     }
@@ -475,26 +478,3 @@ DRESULT disk_ioctl(uint8_t cmd, void* buff) {
 
     return res;
 }
-
-// This function must be called from timer interrupt routine in period
-// of 1 ms to generate card control timing.
-// OS will schedule this periodic task
-void disk_timerproc(void) {
-    uint16_t n;
-
-    n = Timer1; // 1kHz decrement timer stopped at 0
-    if (n)
-        Timer1 = --n;
-    n = Timer2;
-    if (n)
-        Timer2 = --n;
-
-    // uint8_t s = Stat;
-    // TODO: check write protection
-    // if (MMC_WP) s |= STA_PROTECT;
-    // else s &= ~STA_PROTECT;
-    // TODO: check if card is in socket
-    // if (MMC_CD) s &= ~STA_NODISK;
-    // else s |= (STA_NODISK | STA_NOINIT);
-    // Stat = s;
-}
@@ -1,5 +1,6 @@
 // Driver for ESP8266 module to act as a WiFi client or server
-// Currently restricted to one incoming or outgoing connection at a time
+// As a server it accepts up to ESP_LINKS connections at a time (CIPMUX mode),
+// as a client it makes one outgoing connection
 // ESP8266 resources below:
 // General info and AT commands: http://nurdspace.nl/ESP8266
 // General info and AT commands: http://www.electrodragon.com/w/Wi07c
@@ -23,8 +24,17 @@
 //  7 Reset   PB1       TM4C123 can issue output low to cause hardware reset
 //  8 Vcc               regulated 3.3V supply with at least 70mA
 
+// Optional flow control (ESP8266_SetBaud), UART2 has no RTS/CTS so it's done
+// in software. The ESP-01 doesn't break these out, it needs a module like the
+// ESP-12.
+// ESP8266    TM4C123
+//    GPIO13  PC4       RTS out of TM4C123 (ESP's CTS), high to stop the ESP
+//    GPIO15  PC5       CTS into TM4C123 (ESP's RTS), high while it's full
+
+#include "OS.h"
 #include "esp8266.h"
 #include "fifo.h"
+#include "heap.h"
 #include "interrupts.h"
 #include "io.h"
 #include "printf.h"
@@ -38,6 +48,7 @@
 #include "tivaware/pin_map.h"
 #include "tivaware/rom.h"
 #include "tivaware/sysctl.h"
+#include "trace.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -61,10 +72,62 @@ bool ESP8266_EchoCommand = false;
 bool ESP8266_ConnectionMux = false;
 
 #define FIFOSIZE 1024 // size of the FIFOs
-static FIFO* rxfifo;
-static FIFO* rxdata_fifo;
+// received data is buffered separately for each connection
+#define LINK_FIFOSIZE 512
+static FIFO* link_rx[ESP_LINKS];
 static FIFO* txfifo;
 
+static Sema4 at_lock; // one command and its response at a time
+
+// how long to wait for a response, joining and scanning take seconds
+#define AT_TIMEOUT_MS 5000
+#define JOIN_TIMEOUT_MS 20000
+#define SCAN_TIMEOUT_MS 10000
+
+// The response the current command is waiting for. The receive ISR matches it
+// a letter at a time and signals response_done, so the caller sleeps instead
+// of reading the response itself.
+static struct {
+    const char* success;
+    const char* failure; // 0 if only success is expected
+    const char* s;       // how much of each has matched so far
+    const char* f;
+    volatile bool pending;
+    volatile bool ok;
+} response;
+static Sema4 response_done;
+
+// Outgoing data is batched into packets of up to the CIPSEND limit, which
+// esp_sender sends when asked to flush or ESP_FLUSH_MS after the first write
+#define ESP_PACKET_SIZE 2048
+#define ESP_FLUSH_MS 20
+#define TX_PENDING 1 // flags in tx_events
+#define TX_FLUSH 2
+#define TX_SPACE 4
+static char* tx_batch;
+static uint32_t tx_len;
+static uint8_t tx_link; // where the batch is going
+static Sema4 tx_lock;
+static EventGroup tx_events;
+static uint32_t sender_id;
+
+// connection state, from the status lines the module sends on its own
+// flags in link_events:
+#define LINK_DATA(link) (1 << (link)) // data arrived in an empty link_rx
+#define LINK_OPEN (1 << 8)            // any link connected
+#define LINK_CLOSED(link) (1 << (16 + (link)))
+static EventGroup link_events;
+static volatile uint8_t links_open;  // bit for each connected link
+static volatile uint8_t links_taken; // connected links that have an owner
+static char status_line[16];
+static uint8_t status_len;
+
+// In transparent (CIPMODE=1) mode everything the module sends is data for the
+// one connection and everything written to it is sent, with no AT framing.
+// at_lock is held for the whole session since commands would just be sent.
+static volatile bool passthrough;
+static Sema4 raw_lock; // one writer at a time in passthrough
+
 // ESP8266 state
 uint16_t ESP8266_Server = 0; // server port, if any
 
@@ -73,9 +136,28 @@ static uint32_t ReceiveDataSearchIndex = 0;
 static uint32_t ReceiveDataState = 1;  // 0 to disable filtering
 static uint32_t ReceiveDataStream = 0; // connection ID for received data
 static uint32_t ReceiveDataLen = 0;    // receive data packet remaining size
-volatile uint32_t ESP8266_DataAvailable =
-    0;                                  // received data (about to be) available
 volatile uint32_t ESP8266_DataLoss = 0; // lost data (for debugging)
+volatile uint32_t ESP8266_Overruns = 0; // hardware FIFO overflowed
+
+#define RTS_PIN GPIO_PIN_4
+#define CTS_PIN GPIO_PIN_5
+#define RX_HIGH_WATER 64 // space left in a ring when we ask the ESP to stop
+static bool flow_control;
+static volatile bool rx_stopped;
+
+// add received data to a link's ring
+static void link_put(uint8_t link, char letter) {
+    FIFO* fifo = link < ESP_LINKS ? link_rx[link] : 0;
+    if (fifo && fifo_empty(fifo)) {
+        OS_SetEvents(&link_events, LINK_DATA(link));
+    }
+    if (!fifo || !fifo_try_put(fifo, letter)) { // overflow, data loss
+        ESP8266_DataLoss++;
+    } else if (flow_control && fifo_space(fifo) < RX_HIGH_WATER) {
+        ROM_GPIOPinWrite(GPIO_PORTC_BASE, RTS_PIN, RTS_PIN);
+        rx_stopped = true;
+    }
+}
 
 // State machine to filter out received data stream from UART Rx input
 // Inputs: character to check
@@ -84,15 +166,7 @@ static bool ReceiveDataFilter(char letter) {
     switch (ReceiveDataState) { // Filter FSM
     case 4: // filter out data and put it into the right receive FIFO
         if (ReceiveDataLen) {
-            switch (ReceiveDataStream) {
-            case 0:
-                if (!fifo_try_put(rxdata_fifo, letter)) { // overflow, data loss
-                    ESP8266_DataAvailable--;
-                    ESP8266_DataLoss++;
-                }
-                break;
-                // only one connection currently supported
-            }
+            link_put(ReceiveDataStream, letter);
             ReceiveDataLen--;
             return true;
         }
@@ -130,8 +204,6 @@ static bool ReceiveDataFilter(char letter) {
                 ReceiveDataLen * 10 + (letter - '0'); // add digit to length
         } else if (letter == ':') {
             ReceiveDataState = 4; // size complete, move on
-            ESP8266_DataAvailable +=
-                ReceiveDataLen; // mark as becoming available
         } else {
             ReceiveDataStream = 0;
             ReceiveDataLen = 0;
@@ -142,6 +214,73 @@ static bool ReceiveDataFilter(char letter) {
     return false;
 }
 
+// whether the last line was a status, with or without a link ID
+static bool status_is(const char* status) {
+    const char* line = status_line;
+    uint8_t len = status_len;
+    if (len > 2 && line[0] >= '0' && line[0] < '0' + ESP_LINKS &&
+        line[1] == ',') {
+        line += 2;
+        len -= 2;
+    }
+    return len == strlen(status) && !memcmp(line, status, len);
+}
+
+// the link a status line is about, 0 when it doesn't say
+static uint8_t status_link(void) {
+    return status_len > 2 && status_line[1] == ',' ? status_line[0] - '0' : 0;
+}
+
+// one letter further through a pattern, starting over on a mismatch
+static const char* match_step(const char* pattern, const char* at,
+                              char letter) {
+    if (letter == *at) {
+        return at + 1;
+    }
+    return letter == *pattern ? pattern + 1 : pattern;
+}
+
+// Matches the lines that aren't received data against the pending response
+static void ReceiveResponse(char letter) {
+    if (!response.pending) {
+        return;
+    }
+    response.s = match_step(response.success, response.s, letter);
+    if (response.failure) {
+        response.f = match_step(response.failure, response.f, letter);
+    }
+    if (response.failure && !*response.f) {
+        response.ok = false;
+    } else if (!*response.s) {
+        response.ok = true;
+    } else {
+        return;
+    }
+    response.pending = false;
+    OS_Signal(&response_done);
+}
+
+// Watches the lines that aren't received data for the connection opening and
+// closing, which the module can report at any time
+static void ReceiveStatusLine(char letter) {
+    if (letter != '\n') {
+        if (status_len < sizeof(status_line)) {
+            status_line[status_len++] = letter;
+        }
+        return;
+    }
+    if (status_is("CONNECT\r")) {
+        links_open |= 1 << status_link();
+        OS_SetEvents(&link_events, LINK_OPEN);
+    } else if (status_is("CLOSED\r")) {
+        uint8_t link = status_link();
+        links_open &= ~(1 << link);
+        links_taken &= ~(1 << link);
+        OS_SetEvents(&link_events, LINK_CLOSED(link));
+    }
+    status_len = 0;
+}
+
 // Preprocessor magic to construct UARTx_ identifiers
 #define STR(x) #x
 #define CONCAT(x, y, z) x##y##z
@@ -151,10 +290,57 @@ static bool ReceiveDataFilter(char letter) {
 
 #define UART_ESP8266(identifier) HWREG(UART2_BASE + UART_##identifier)
 
-const uint32_t baud = 115200;
+const uint32_t baud = 115200; // until ESP8266_SetBaud
+static uint32_t current_baud; // set by ESP8266_InitUART
+
+// the UART has to be disabled while the divisor changes, and writing LCRH
+// is what latches it
+static void esp_uart_baud(uint32_t rate) {
+    UART_ESP8266(O_CTL) &=
+        ~UART_CTL_UARTEN; // Clear UART enable bit during config
+    UART_ESP8266(O_IBRD) = (80000000 / 16) / rate;
+    UART_ESP8266(O_FBRD) = ((64 * ((80000000 / 16) % rate)) + rate / 2) / rate;
+    UART_ESP8266(O_LCRH) =
+        (UART_LCRH_WLEN_8 |
+         UART_LCRH_FEN); // 8 bit word length, 1 stop, no parity, FIFOs enabled
+    UART_ESP8266(O_CTL) |=
+        (UART_CTL_UARTEN | UART_CTL_RXE | UART_CTL_TXE); // Set UART enable bit
+    current_baud = rate;
+}
+
+// wait for everything queued to be on the wire, then switch
+static void esp_switch_baud(uint32_t rate) {
+    while (!fifo_empty(txfifo)) { OS_Sleep(ms(1)); }
+    uint32_t crit = start_critical();
+    while (UART_ESP8266(O_FR) & UART_FR_BUSY) {}
+    esp_uart_baud(rate);
+    end_critical(crit);
+}
+
+static void esp_flow_control(bool enable) {
+    flow_control = false;
+    rx_stopped = false;
+    ROM_IntDisable(INT_GPIOC);
+    if (!enable) {
+        return;
+    }
+    ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOC);
+    while (!ROM_SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOC)) {}
+    ROM_GPIOPinTypeGPIOOutput(GPIO_PORTC_BASE, RTS_PIN);
+    ROM_GPIOPinWrite(GPIO_PORTC_BASE, RTS_PIN, 0);
+    ROM_GPIOPinTypeGPIOInput(GPIO_PORTC_BASE, CTS_PIN);
+    // the ESP lowering CTS restarts the transmitter
+    ROM_GPIOIntTypeSet(GPIO_PORTC_BASE, CTS_PIN, GPIO_FALLING_EDGE);
+    HWREG(GPIO_PORTC_BASE + GPIO_O_ICR) = CTS_PIN;
+    HWREG(GPIO_PORTC_BASE + GPIO_O_IM) |= CTS_PIN;
+    ROM_IntPrioritySet(INT_GPIOC, 4 << 5);
+    flow_control = true;
+    ROM_IntEnable(INT_GPIOC);
+}
 void ESP8266_InitUART(int rx_echo, int tx_echo) {
-    rxfifo = fifo_new(FIFOSIZE);
-    rxdata_fifo = fifo_new(FIFOSIZE);
+    if (!link_rx[0]) {
+        link_rx[0] = fifo_new(LINK_FIFOSIZE);
+    }
     txfifo = fifo_new(FIFOSIZE);
     ESP8266_EchoResponse = rx_echo;
     ESP8266_EchoCommand = tx_echo;
@@ -167,33 +353,28 @@ void ESP8266_InitUART(int rx_echo, int tx_echo) {
     ROM_GPIOPinTypeUART(GPIO_PORTD_BASE, GPIO_PIN_6 | GPIO_PIN_7);
 
     // Initialize the UART. Set the baud rate, number of data bit
-    UART_ESP8266(O_CTL) &=
-        ~UART_CTL_UARTEN; // Clear UART enable bit during config
-    UART_ESP8266(O_IBRD) = (80000000 / 16) / baud;
-    UART_ESP8266(O_FBRD) = ((64 * ((80000000 / 16) % baud)) + baud / 2) / baud;
-    // UART_ESP8266(_IBRD_R) = 43;   // IBRD = int(80,000,000 / (16 * 115,200))
-    // = int(43.403) UART_ESP8266(_FBRD_R) = 26;   // FBRD = round(0.4028 * 64 )
-    // = 26
-    UART_ESP8266(O_LCRH) =
-        (UART_LCRH_WLEN_8 |
-         UART_LCRH_FEN); // 8 bit word length, 1 stop, no parity, FIFOs enabled
+    esp_uart_baud(baud);
     UART_ESP8266(O_IFLS) &=
         ~0x3F; // Clear TX and RX interrupt FIFO level fields
-    UART_ESP8266(O_IFLS) +=
-        (UART_IFLS_TX1_8 |
-         UART_IFLS_RX1_8); // RX and TX FIFO interrupt threshold >= 1/8th full
+    // interrupt once the RX FIFO is half full so each one drains 8 or more
+    // bytes at a time (the receive timeout picks up the rest), and refill
+    // the TX FIFO when it gets down to 2
+    UART_ESP8266(O_IFLS) += (UART_IFLS_TX1_8 | UART_IFLS_RX4_8);
     UART_ESP8266(O_IM) |=
         (UART_IM_RXIM | UART_IM_TXIM |
          UART_IM_RTIM); // Enable interupt on TX, RX and RX transmission end
-    UART_ESP8266(O_CTL) |=
-        (UART_CTL_UARTEN | UART_CTL_RXE | UART_CTL_TXE); // Set UART enable bit
+}
+
+// whether the ESP has asked us to stop sending
+static bool tx_stopped(void) {
+    return flow_control && ROM_GPIOPinRead(GPIO_PORTC_BASE, CTS_PIN);
 }
 
 // Copies TX buffer (software defined FIFO) to uart
 void static ESP8266BufferToTx(void) {
     uint8_t letter;
     while (((UART_ESP8266(O_FR) & UART_FR_TXFF) == 0) &&
-           (!fifo_empty(txfifo))) {
+           (!fifo_empty(txfifo)) && !tx_stopped()) {
         fifo_try_get(txfifo, &letter);
         if (ESP8266_EchoCommand) {
             uart_putchar(letter);
@@ -202,25 +383,34 @@ void static ESP8266BufferToTx(void) {
     }
 }
 
-// Copies uart fifo to RX buffer (software defined FIFO)
+// Copies uart fifo to the link rings, or to the response matcher
+// The hardware FIFO is always emptied so received data keeps flowing
 static void ESP8266RxToBuffer(void) {
     char letter;
-    while (((UART_ESP8266(O_FR) & UART_FR_RXFE) == 0) && !fifo_full(rxfifo)) {
-        letter = UART_ESP8266(O_DR);
+    while ((UART_ESP8266(O_FR) & UART_FR_RXFE) == 0) {
+        uint32_t data = UART_ESP8266(O_DR);
+        if (data & UART_DR_OE) {
+            ESP8266_Overruns++;
+        }
+        letter = data;
         if (ESP8266_EchoResponse) {
             uart_putchar(letter);
         }
-        if (!ReceiveDataFilter(letter)) {
-            fifo_try_put(rxfifo, letter);
+        if (passthrough) {
+            link_put(0, letter);
+        } else if (!ReceiveDataFilter(letter)) {
+            ReceiveResponse(letter);
+            ReceiveStatusLine(letter);
         }
     }
 }
 
 // at least one of three things has happened:
 // hardware TX FIFO goes from 3 to 2 or less items
-// hardware RX FIFO goes from 1 to 2 or more items
+// hardware RX FIFO goes from 7 to 8 or more items
 // UART receiver has timed out
 void uart2_handler(void) {
+    TRACE_ISR_ENTER();
     if (UART_ESP8266(O_RIS) & UART_RIS_TXRIS) { // hardware TX FIFO <= 2 items
         UART_ESP8266(O_ICR) = UART_ICR_TXIC;    // acknowledge TX FIFO
         ESP8266BufferToTx();
@@ -228,7 +418,7 @@ void uart2_handler(void) {
             UART_ESP8266(O_IM) &= ~UART_IM_TXIM; // disable TX FIFO interrupt
         }
     }
-    if (UART_ESP8266(O_RIS) & UART_RIS_RXRIS) { // hardware RX FIFO >= 2 items
+    if (UART_ESP8266(O_RIS) & UART_RIS_RXRIS) { // hardware RX FIFO >= 8 items
         UART_ESP8266(O_ICR) = UART_ICR_RXIC;    // acknowledge RX FIFO
         ESP8266RxToBuffer();
     }
@@ -236,19 +426,26 @@ void uart2_handler(void) {
         UART_ESP8266(O_ICR) = UART_ICR_RTIC;    // acknowledge receiver time out
         ESP8266RxToBuffer();
     }
+    TRACE_ISR_EXIT();
 }
 
-static void esp_putc(char data) {
-    while (!fifo_try_put(txfifo, data)) {};
-    UART_ESP8266(O_IM) &= ~UART_IM_TXIM; // disable TX FIFO interrupt
+// the ESP is ready for more after stopping us
+void gpio_portc_handler(void) {
+    TRACE_ISR_ENTER();
+    HWREG(GPIO_PORTC_BASE + GPIO_O_ICR) = CTS_PIN;
     ESP8266BufferToTx();
-    UART_ESP8266(O_IM) |= UART_IM_TXIM; // enable TX FIFO interrupt
+    TRACE_ISR_EXIT();
 }
 
-static char esp_getc(void) {
-    uint8_t letter;
-    while (!fifo_try_get(rxfifo, &letter)) {};
-    return letter;
+static void esp_putc(char data) {
+    // the TX interrupt is always enabled while txfifo is full, so wait for it
+    // to make space
+    fifo_put(txfifo, data);
+    // the CTS interrupt can also refill the hardware FIFO
+    uint32_t crit = start_critical();
+    ESP8266BufferToTx();
+    end_critical(crit);
+    UART_ESP8266(O_IM) |= UART_IM_TXIM; // enable TX FIFO interrupt
 }
 
 static void esp_puts(const char* command) {
@@ -256,30 +453,70 @@ static void esp_puts(const char* command) {
     while (command[index]) { esp_putc(command[index++]); }
 }
 
-bool ESP8266_WaitForResponse(const char* success, const char* failure) {
-    char d;
-    const char* s = success;
-    const char* f = failure;
-    while ((!s || *s) && (!f || *f)) { // end of search string reached?
-        d = esp_getc();
-        if (s && (d == *s)) {
-            s++;
-        } else {
-            s = success; // start over
-            if (s && (d == *s))
-                s++; // match first char?
-        }
-        if (f && (d == *f)) {
-            f++;
-        } else {
-            f = failure; // start over
-            if (f && (d == *f))
-                f++; // match first char?
+static void esp_write(const char* buf, uint32_t len) {
+    while (len--) { esp_putc(*buf++); }
+}
+
+// Start matching a response, before whatever it answers is sent so it can't
+// be missed. Anything received before this is ignored.
+// the caller must hold at_lock
+static void esp_expect(const char* success, const char* failure) {
+    uint32_t crit = start_critical();
+    response.success = response.s = success;
+    response.failure = response.f = failure;
+    response.ok = false;
+    response.pending = true;
+    // a response that came in after its caller gave up may have signalled
+    OS_InitSemaphore(&response_done, -1);
+    end_critical(crit);
+}
+
+// wait up to timeout_ms for the expected response
+// returns true if it was success, false on failure or timeout
+static bool esp_response(uint32_t timeout_ms) {
+    bool done = OS_WaitTimeout(&response_done, ms(timeout_ms));
+    uint32_t crit = start_critical();
+    response.pending = false;
+    end_critical(crit);
+    return done && response.ok;
+}
+
+// start a command, the caller must hold at_lock
+static void esp_start_command(const char* command, const char* success,
+                              const char* failure) {
+    esp_expect(success, failure);
+    esp_puts(command);
+}
+
+static bool esp_command_timeout(const char* command, const char* success,
+                                const char* failure, uint32_t timeout_ms) {
+    OS_Wait(&at_lock);
+    esp_start_command(command, success, failure);
+    bool ok = esp_response(timeout_ms);
+    OS_Signal(&at_lock);
+    return ok;
+}
+
+static bool esp_command(const char* command, const char* success,
+                        const char* failure) {
+    return esp_command_timeout(command, success, failure, AT_TIMEOUT_MS);
+}
+
+// Sends batched writes. Runs at the same priority as the interpreters so a
+// flush doesn't preempt a writer that's about to add more.
+static void esp_sender(void) {
+    while (true) {
+        OS_WaitEvents(&tx_events, TX_PENDING, false, true, 0);
+        OS_WaitEvents(&tx_events, TX_FLUSH, false, true, ms(ESP_FLUSH_MS));
+        OS_Wait(&tx_lock);
+        if (tx_len && links_open & 1 << tx_link) {
+            esp_socket_send(tx_link, tx_batch, tx_len);
         }
+        tx_len = 0; // nowhere to send it if the connection is gone
+        OS_ClearEvents(&tx_events, TX_PENDING | TX_FLUSH);
+        OS_SetEvents(&tx_events, TX_SPACE);
+        OS_Signal(&tx_lock);
     }
-    if (failure && !(*f))
-        return false;
-    return true;
 }
 
 bool ESP8266_Init(bool rx_echo, bool tx_echo) {
@@ -287,8 +524,26 @@ bool ESP8266_Init(bool rx_echo, bool tx_echo) {
     const char* s;
     uint32_t timer = 1;
 
+    if (!tx_batch) {
+        if (!(tx_batch = malloc(ESP_PACKET_SIZE))) {
+            return false;
+        }
+        OS_InitSemaphore(&at_lock, 0);
+        OS_InitSemaphore(&raw_lock, 0);
+        OS_InitSemaphore(&tx_lock, 0);
+        OS_InitSemaphore(&response_done, -1);
+        OS_InitEvents(&tx_events);
+        OS_InitEvents(&link_events);
+    }
+    if (!sender_id &&
+        !(sender_id = OS_AddThread(esp_sender, "ESP sender", 1024, 2))) {
+        return false;
+    }
+
     ROM_IntDisable(INT_UART2);
+    esp_flow_control(false); // the reset puts it back to the default
     ESP8266_InitUART(rx_echo, tx_echo);
+    links_open = links_taken = 0;
     ROM_GPIOPinTypeGPIOOutput(GPIO_PORTB_BASE, GPIO_PIN_1); // Reset pin
 
     // Hard reset
@@ -332,8 +587,7 @@ bool ESP8266_Connect(bool verbose) {
 bool ESP8266_SetConnectionMux(bool multiple) {
     char TXBuffer[32];
     sprintf(TXBuffer, "AT+CIPMUX=%d\r\n", multiple);
-    esp_puts(TXBuffer);
-    if (ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, 0)) {
+    if (esp_command(TXBuffer, ESP8266_OK_RESPONSE, 0)) {
         ESP8266_ConnectionMux = multiple;
         return true;
     }
@@ -341,11 +595,18 @@ bool ESP8266_SetConnectionMux(bool multiple) {
 }
 
 bool ESP8266_StartServer(uint16_t port, uint16_t timeout) {
+    if (ESP8266_Server == port) { // already running, share it
+        return true;
+    }
+    for (uint8_t i = 1; i < ESP_LINKS; i++) {
+        if (!link_rx[i] && !(link_rx[i] = fifo_new(LINK_FIFOSIZE))) {
+            return false;
+        }
+    }
     ESP8266_SetConnectionMux(true);
     char TXBuffer[32];
     sprintf(TXBuffer, "AT+CIPSERVER=1,%d\r\n", port);
-    esp_puts(TXBuffer);
-    if (ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, 0)) {
+    if (esp_command(TXBuffer, ESP8266_OK_RESPONSE, 0)) {
         ESP8266_Server = port;
         return ESP8266_SetServerTimeout(timeout);
     }
@@ -353,85 +614,181 @@ bool ESP8266_StartServer(uint16_t port, uint16_t timeout) {
 }
 
 bool ESP8266_StopServer(void) {
-    esp_puts("AT+CIPSERVER=0\r\n");
     ESP8266_Server = 0;
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, 0) &&
+    return esp_command("AT+CIPSERVER=0\r\n", ESP8266_OK_RESPONSE, 0) &&
            ESP8266_SetConnectionMux(false);
 }
 
 bool ESP8266_Reset(void) {
-    esp_puts("AT+RST\r\n");
-    return ESP8266_WaitForResponse(ESP8266_READY_RESPONSE, 0);
+    if (current_baud == baud) {
+        return esp_command("AT+RST\r\n", ESP8266_READY_RESPONSE, 0);
+    }
+    // it comes back up at the default rate, so switch before "ready"
+    OS_Wait(&at_lock);
+    esp_start_command("AT+RST\r\n", ESP8266_READY_RESPONSE, 0);
+    esp_switch_baud(baud);
+    esp_flow_control(false);
+    bool ok = esp_response(AT_TIMEOUT_MS);
+    OS_Signal(&at_lock);
+    return ok;
+}
+
+bool ESP8266_SetBaud(uint32_t rate, bool flow) {
+    if (rate < 9600 || rate > 80000000 / 16) {
+        return false;
+    }
+    char TXBuffer[40];
+    snprintf(TXBuffer, sizeof(TXBuffer), "AT+UART_CUR=%d,8,1,0,%d\r\n", rate,
+             flow ? 3 : 0);
+    OS_Wait(&at_lock);
+    esp_start_command(TXBuffer, ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
+    // it answers at the old rate then switches
+    if (!esp_response(AT_TIMEOUT_MS)) {
+        OS_Signal(&at_lock);
+        return false;
+    }
+    uint32_t old = current_baud;
+    bool old_flow = flow_control;
+    esp_switch_baud(rate);
+    esp_flow_control(flow);
+    OS_Sleep(ms(10));
+    esp_start_command("AT\r\n", ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
+    bool ok = esp_response(AT_TIMEOUT_MS);
+    OS_Signal(&at_lock);
+    if (!ok) { // the link doesn't work at this rate, go back
+        snprintf(TXBuffer, sizeof(TXBuffer), "AT+UART_CUR=%d,8,1,0,%d\r\n",
+                 old, old_flow ? 3 : 0);
+        esp_command(TXBuffer, ESP8266_OK_RESPONSE, 0); // garbled at our end
+        esp_switch_baud(old);
+        esp_flow_control(old_flow);
+    }
+    return ok;
+}
+
+uint32_t ESP8266_Baud(void) {
+    return current_baud;
 }
 
 bool ESP8266_Restore(void) {
-    esp_puts("AT+RESTORE\r\n");
-    return ESP8266_WaitForResponse(ESP8266_READY_RESPONSE, 0);
+    return esp_command("AT+RESTORE\r\n", ESP8266_READY_RESPONSE, 0);
 }
 
 bool ESP8266_GetVersionNumber(void) {
-    esp_puts("AT+GMR\r\n");
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, 0);
+    return esp_command("AT+GMR\r\n", ESP8266_OK_RESPONSE, 0);
 }
 
 bool ESP8266_GetMACAddress(void) {
-    esp_puts("AT+CIPSTAMAC?\r\n");
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, 0);
+    return esp_command("AT+CIPSTAMAC?\r\n", ESP8266_OK_RESPONSE, 0);
 }
 
 bool ESP8266_SetWifiMode(uint8_t mode) {
     char TXBuffer[32];
     sprintf(TXBuffer, "AT+CWMODE=%d\r\n", mode);
-    esp_puts(TXBuffer);
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, 0);
+    return esp_command(TXBuffer, ESP8266_OK_RESPONSE, 0);
 }
 
 bool ESP8266_ListAccessPoints(void) {
-    esp_puts("AT+CWLAP\r\n");
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
+    return esp_command_timeout("AT+CWLAP\r\n", ESP8266_OK_RESPONSE,
+                               ESP8266_ERROR_RESPONSE, SCAN_TIMEOUT_MS);
 }
 
 bool ESP8266_JoinAccessPoint(const char* ssid, const char* password) {
-    esp_puts("AT+CWJAP=\"");
-    esp_puts(ssid);
-    esp_puts("\",\"");
-    esp_puts(password);
-    esp_puts("\"\r\n");
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, ESP8266_FAIL_RESPONSE);
+    char TXBuffer[128]; // ssid is at most 32 characters and password 64
+    snprintf(TXBuffer, sizeof(TXBuffer), "AT+CWJAP=\"%s\",\"%s\"\r\n", ssid,
+             password);
+    return esp_command_timeout(TXBuffer, ESP8266_OK_RESPONSE,
+                               ESP8266_FAIL_RESPONSE, JOIN_TIMEOUT_MS);
 }
 
 bool ESP8266_QuitAccessPoint(void) {
-    esp_puts("AT+CWQAP\r\n");
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, 0);
+    return esp_command("AT+CWQAP\r\n", ESP8266_OK_RESPONSE, 0);
 }
 
 bool ESP8266_GetIPAddress(void) {
-    esp_puts("AT+CIFSR\r\n");
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
+    return esp_command("AT+CIFSR\r\n", ESP8266_OK_RESPONSE,
+                       ESP8266_ERROR_RESPONSE);
 }
 
 bool ESP8266_MakeTCPConnection(char* IPaddress, uint16_t port) {
-    char TXBuffer[32];
-    esp_puts("AT+CIPSTART=\"TCP\",\"");
-    esp_puts(IPaddress);
-    sprintf(TXBuffer, "\",%d\r\n", port);
-    esp_puts(TXBuffer); // open and connect to a socket
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
+    char TXBuffer[96];
+    snprintf(TXBuffer, sizeof(TXBuffer), "AT+CIPSTART=\"TCP\",\"%s\",%d\r\n",
+             IPaddress, port);
+    if (!esp_command(TXBuffer, ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE)) {
+        return false;
+    }
+    links_taken |= 1; // so a server doesn't accept it
+    OS_RedirectLink(0);
+    return true;
 }
 
 bool ESP8266_Send(const char* str) {
+    return ESP8266_SendBytes(str, strlen(str));
+}
+
+bool ESP8266_SendBytes(const char* buf, uint32_t len) {
+    return esp_socket_send(OS_Link(), buf, len);
+}
+
+bool esp_socket_send(uint8_t link, const char* buf, uint32_t len) {
+    if (passthrough) {
+        OS_Wait(&raw_lock);
+        esp_write(buf, len);
+        OS_Signal(&raw_lock);
+        return link == 0;
+    }
     char TXBuffer[32];
     if (ESP8266_ConnectionMux) {
-        sprintf(TXBuffer, "AT+CIPSEND=%d,%d\r\n", 0, strlen(str));
+        sprintf(TXBuffer, "AT+CIPSEND=%d,%d\r\n", link, len);
     } else {
-        sprintf(TXBuffer, "AT+CIPSEND=%d\r\n", strlen(str));
+        sprintf(TXBuffer, "AT+CIPSEND=%d\r\n", len);
     }
-    esp_puts(TXBuffer);
-    if (!ESP8266_WaitForResponse(">", ESP8266_ERROR_RESPONSE))
-        return false;
-    esp_puts(str);
-    return ESP8266_WaitForResponse(ESP8266_SENDOK_RESPONSE,
-                                   ESP8266_ERROR_RESPONSE);
+    OS_Wait(&at_lock);
+    esp_start_command(TXBuffer, ">", ESP8266_ERROR_RESPONSE);
+    bool ok = esp_response(AT_TIMEOUT_MS);
+    if (ok) {
+        esp_expect(ESP8266_SENDOK_RESPONSE, ESP8266_ERROR_RESPONSE);
+        esp_write(buf, len);
+        ok = esp_response(AT_TIMEOUT_MS);
+    }
+    OS_Signal(&at_lock);
+    return ok;
+}
+
+void ESP8266_Write(const char* buf, uint32_t len) {
+    uint8_t link = OS_Link();
+    while (len) {
+        OS_Wait(&tx_lock);
+        if (tx_len && tx_link != link) {
+            // the batch belongs to another connection, let it go first
+            OS_ClearEvents(&tx_events, TX_SPACE);
+            OS_Signal(&tx_lock);
+            OS_SetEvents(&tx_events, TX_PENDING | TX_FLUSH);
+            OS_WaitEvents(&tx_events, TX_SPACE, false, true, 0);
+            continue;
+        }
+        tx_link = link;
+        uint32_t n = min(len, ESP_PACKET_SIZE - tx_len);
+        memcpy(tx_batch + tx_len, buf, n);
+        tx_len += n;
+        bool flush = tx_len == ESP_PACKET_SIZE;
+        for (uint32_t i = 0; i < n && !flush; i++) {
+            flush = buf[i] == '\n' || buf[i] == '\x03';
+        }
+        if (tx_len == ESP_PACKET_SIZE) {
+            OS_ClearEvents(&tx_events, TX_SPACE);
+        }
+        OS_Signal(&tx_lock);
+        OS_SetEvents(&tx_events, flush ? TX_PENDING | TX_FLUSH : TX_PENDING);
+        buf += n;
+        len -= n;
+        if (len) { // the batch is full, wait for the sender to empty it
+            OS_WaitEvents(&tx_events, TX_SPACE, false, true, 0);
+        }
+    }
+}
+
+void ESP8266_Flush(void) {
+    OS_SetEvents(&tx_events, TX_FLUSH);
 }
 
 bool ESP8266_SendBuffered(const char* str) {
@@ -441,91 +798,196 @@ bool ESP8266_SendBuffered(const char* str) {
     } else {
         sprintf(TXBuffer, "AT+CIPSEND=%d\r\n", strlen(str));
     }
-    esp_puts(TXBuffer);
-    if (!ESP8266_WaitForResponse(">", ESP8266_ERROR_RESPONSE))
-        return false;
-    esp_puts(str);
-    sprintf(TXBuffer, "Recv %d bytes", strlen(str));
-    return ESP8266_WaitForResponse(TXBuffer, ESP8266_ERROR_RESPONSE);
+    OS_Wait(&at_lock);
+    esp_start_command(TXBuffer, ">", ESP8266_ERROR_RESPONSE);
+    bool ok = esp_response(AT_TIMEOUT_MS);
+    if (ok) {
+        sprintf(TXBuffer, "Recv %d bytes", strlen(str));
+        esp_expect(TXBuffer, ESP8266_ERROR_RESPONSE);
+        esp_puts(str);
+        ok = esp_response(AT_TIMEOUT_MS);
+    }
+    OS_Signal(&at_lock);
+    return ok;
+}
+
+int8_t esp_socket_accept(uint32_t timeout) {
+    uint32_t deadline = OS_Time() + timeout;
+    while (true) {
+        uint32_t crit = start_critical();
+        uint8_t waiting = links_open & ~links_taken;
+        if (waiting) {
+            uint8_t link = __builtin_ctz(waiting);
+            links_taken |= 1 << link;
+            end_critical(crit);
+            return link;
+        }
+        end_critical(crit);
+        uint32_t remaining = 0;
+        if (timeout) {
+            remaining = deadline - OS_Time();
+            if ((int32_t)remaining <= 0) {
+                return -1;
+            }
+        }
+        OS_WaitEvents(&link_events, LINK_OPEN, false, true, remaining);
+    }
+}
+
+int32_t esp_socket_recv(uint8_t link, void* buf, uint32_t max,
+                        uint32_t timeout) {
+    FIFO* fifo = link < ESP_LINKS ? link_rx[link] : 0;
+    uint8_t* out = buf;
+    if (!fifo || !max) {
+        return 0;
+    }
+    uint32_t deadline = OS_Time() + timeout;
+    while (!fifo_try_get(fifo, out)) {
+        if (!(links_open & 1 << link)) {
+            return 0;
+        }
+        uint32_t remaining = 0;
+        if (timeout) {
+            remaining = deadline - OS_Time();
+            if ((int32_t)remaining <= 0) {
+                return 0;
+            }
+        }
+        OS_WaitEvents(&link_events, LINK_DATA(link) | LINK_CLOSED(link), false,
+                      true, remaining);
+    }
+    uint32_t n = 1;
+    while (n < max && fifo_try_get(fifo, out + n)) { n++; }
+    if (rx_stopped && fifo_space(fifo) > fifo_size(fifo)) {
+        rx_stopped = false; // at least half empty, let the ESP go again
+        ROM_GPIOPinWrite(GPIO_PORTC_BASE, RTS_PIN, 0);
+    }
+    return n;
+}
+
+bool esp_socket_connected(uint8_t link) {
+    return link < ESP_LINKS && links_open & 1 << link;
+}
+
+// get the next byte received on this thread's connection
+// returns false once the connection is closed and everything has been read
+static bool esp_recv_byte(uint8_t* letter) {
+    return esp_socket_recv(OS_Link(), letter, 1, 0) == 1;
 }
 
 bool ESP8266_Receive(char* buf, uint32_t max) {
-    long sr;
     uint8_t letter;
     while (max > 1) {
-        if (fifo_size(rxdata_fifo) ||
-            ESP8266_DataAvailable) { // data (about to be) available?
-            while (fifo_try_get(rxdata_fifo, &letter) == false) {};
-            sr = start_critical();
-            if (ESP8266_DataAvailable)
-                ESP8266_DataAvailable--;
-            end_critical(sr);
-            if (letter == '\r')
-                continue;
-            if (letter == '\n')
-                break;
-            *buf = letter;
-            buf++;
-            max--;
-        } else { // wait for next packet or connection close
-            if (!ESP8266_WaitForResponse(ReceiveDataSearchString,
-                                         ESP8266_ConnectionMux ? "0,CLOSED"
-                                                               : "CLOSED")) {
-                *buf = 0; // connection closed
-                return false;
-            }
-            while (esp_getc() != ':') {} // wait for DataAvailable to be updated
+        if (!esp_recv_byte(&letter)) {
+            *buf = 0; // connection closed
+            return false;
         }
+        if (letter == '\r')
+            continue;
+        if (letter == '\n')
+            break;
+        *buf = letter;
+        buf++;
+        max--;
     }
     *buf = 0; // terminate with null character
     return true;
 }
 
 bool ESP8266_ReceiveEcho() {
-    long sr;
     uint8_t letter;
     while (true) {
-        if (fifo_size(rxdata_fifo) ||
-            ESP8266_DataAvailable) { // data (about to be) available?
-            while (fifo_try_get(rxdata_fifo, &letter) == false) {};
-            sr = start_critical();
-            if (ESP8266_DataAvailable)
-                ESP8266_DataAvailable--;
-            end_critical(sr);
-            if (letter == '\x03') // ETX
-                break;
-            uart_putchar(letter);
-        } else { // wait for next packet or connection close
-            if (!ESP8266_WaitForResponse(ReceiveDataSearchString,
-                                         ESP8266_ConnectionMux ? "0,CLOSED"
-                                                               : "CLOSED")) {
-                return false;
-            }
-            while (esp_getc() != ':') {} // wait for DataAvailable to be updated
+        if (!esp_recv_byte(&letter)) {
+            return false;
         }
+        if (letter == '\x03') // ETX
+            break;
+        uart_putchar(letter);
     }
     return true;
 }
 
 bool ESP8266_CloseTCPConnection(void) {
-    esp_puts(ESP8266_ConnectionMux ? "AT+CIPCLOSE=0\r\n" : "AT+CIPCLOSE\r\n");
-    fifo_clear(rxdata_fifo);
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
+    return esp_socket_close(OS_Link());
+}
+
+bool esp_socket_close(uint8_t link) {
+    if (link >= ESP_LINKS) {
+        return false;
+    }
+    char TXBuffer[32];
+    if (ESP8266_ConnectionMux) {
+        sprintf(TXBuffer, "AT+CIPCLOSE=%d\r\n", link);
+    } else {
+        sprintf(TXBuffer, "AT+CIPCLOSE\r\n");
+    }
+    bool ok =
+        esp_command(TXBuffer, ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
+    uint32_t crit = start_critical();
+    fifo_clear(link_rx[link]);
+    end_critical(crit);
+    return ok;
 }
 
 bool ESP8266_GetStatus(void) {
-    esp_puts("AT+CIPSTATUS\r\n");
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, 0);
+    return esp_command("AT+CIPSTATUS\r\n", ESP8266_OK_RESPONSE, 0);
 }
 
 bool ESP8266_SetServerTimeout(uint16_t timeout) {
     char TXBuffer[32];
     sprintf(TXBuffer, "AT+CIPSTO=%d\r\n", timeout);
-    esp_puts(TXBuffer);
-    return ESP8266_WaitForResponse(ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
+    return esp_command(TXBuffer, ESP8266_OK_RESPONSE, ESP8266_ERROR_RESPONSE);
 }
 
 bool ESP8266_WaitForConnection(void) {
-    return ESP8266_ConnectionMux && ESP8266_Server &&
-           ESP8266_WaitForResponse("0,CONNECT\r\n", 0);
+    if (!ESP8266_ConnectionMux || !ESP8266_Server) {
+        return false;
+    }
+    OS_RedirectLink(esp_socket_accept(0));
+    return true;
+}
+
+bool ESP8266_StartPassthrough(void) {
+    if (ESP8266_ConnectionMux || !(links_open & 1)) {
+        return false;
+    }
+    OS_Wait(&at_lock);
+    esp_start_command("AT+CIPMODE=1\r\n", ESP8266_OK_RESPONSE,
+                      ESP8266_ERROR_RESPONSE);
+    if (!esp_response(AT_TIMEOUT_MS)) {
+        OS_Signal(&at_lock);
+        return false;
+    }
+    esp_start_command("AT+CIPSEND\r\n", ">", ESP8266_ERROR_RESPONSE);
+    if (!esp_response(AT_TIMEOUT_MS)) {
+        esp_start_command("AT+CIPMODE=0\r\n", ESP8266_OK_RESPONSE,
+                          ESP8266_ERROR_RESPONSE);
+        esp_response(AT_TIMEOUT_MS);
+        OS_Signal(&at_lock);
+        return false;
+    }
+    passthrough = true; // keep at_lock until it's stopped
+    return true;
+}
+
+bool ESP8266_StopPassthrough(void) {
+    if (!passthrough) {
+        return false;
+    }
+    OS_Wait(&raw_lock);
+    while (!fifo_empty(txfifo) || UART_ESP8266(O_FR) & UART_FR_BUSY) {
+        OS_Sleep(ms(1));
+    }
+    // "+++" only counts as the escape if the line is quiet for a second
+    // before and after it
+    OS_Sleep(ms(1000));
+    esp_puts("+++");
+    OS_Sleep(ms(1000));
+    passthrough = false;
+    OS_Signal(&raw_lock);
+    esp_start_command("AT+CIPMODE=0\r\n", ESP8266_OK_RESPONSE,
+                      ESP8266_ERROR_RESPONSE);
+    bool ok = esp_response(AT_TIMEOUT_MS);
+    OS_Signal(&at_lock);
+    return ok;
 }
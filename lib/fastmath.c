@@ -0,0 +1,203 @@
+#include "fastmath.h"
+#include "std.h"
+#include <stdint.h>
+
+// sin over a quarter wave in 256 steps, in Q15 (the last one is 1.0, which
+// only fits unsigned)
+static const uint16_t quarter_sine[257] = {
+    0, 201, 402, 603, 804, 1005, 1206, 1407, 1608, 1809, 2009, 2210, 2411,
+    2611, 2811, 3012, 3212, 3412, 3612, 3812, 4011, 4211, 4410, 4609, 4808,
+    5007, 5205, 5404, 5602, 5800, 5998, 6195, 6393, 6590, 6787, 6983, 7180,
+    7376, 7571, 7767, 7962, 8157, 8351, 8546, 8740, 8933, 9127, 9319, 9512,
+    9704, 9896, 10088, 10279, 10469, 10660, 10850, 11039, 11228, 11417, 11605,
+    11793, 11980, 12167, 12354, 12540, 12725, 12910, 13095, 13279, 13463,
+    13646, 13828, 14010, 14192, 14373, 14553, 14733, 14912, 15091, 15269,
+    15447, 15624, 15800, 15976, 16151, 16326, 16500, 16673, 16846, 17018,
+    17190, 17361, 17531, 17700, 17869, 18037, 18205, 18372, 18538, 18703,
+    18868, 19032, 19195, 19358, 19520, 19681, 19841, 20001, 20160, 20318,
+    20475, 20632, 20788, 20943, 21097, 21251, 21403, 21555, 21706, 21856,
+    22006, 22154, 22302, 22449, 22595, 22740, 22884, 23028, 23170, 23312,
+    23453, 23593, 23732, 23870, 24008, 24144, 24279, 24414, 24548, 24680,
+    24812, 24943, 25073, 25202, 25330, 25457, 25583, 25708, 25833, 25956,
+    26078, 26199, 26320, 26439, 26557, 26674, 26791, 26906, 27020, 27133,
+    27246, 27357, 27467, 27576, 27684, 27791, 27897, 28002, 28106, 28209,
+    28311, 28411, 28511, 28610, 28707, 28803, 28899, 28993, 29086, 29178,
+    29269, 29359, 29448, 29535, 29622, 29707, 29792, 29875, 29957, 30038,
+    30118, 30196, 30274, 30350, 30425, 30499, 30572, 30644, 30715, 30784,
+    30853, 30920, 30986, 31050, 31114, 31177, 31238, 31298, 31357, 31415,
+    31471, 31527, 31581, 31634, 31686, 31737, 31786, 31834, 31881, 31927,
+    31972, 32015, 32058, 32099, 32138, 32177, 32214, 32251, 32286, 32319,
+    32352, 32383, 32413, 32442, 32470, 32496, 32522, 32546, 32568, 32590,
+    32610, 32629, 32647, 32664, 32679, 32693, 32706, 32718, 32729, 32738,
+    32746, 32753, 32758, 32762, 32766, 32767, 32768,
+};
+
+// angle is in 2^24ths of a turn, which leaves 14 bits of fraction between
+// table entries to interpolate with
+static float interpolate_sine(uint32_t angle) {
+    uint32_t quadrant = angle >> 22 & 3;
+    uint32_t within = angle & 0x3FFFFF;
+    if (quadrant & 1) { // the second quarter wave is the first one backwards
+        within = 0x400000 - within;
+    }
+    uint32_t idx = within >> 14;
+    float lo = quarter_sine[idx];
+    float hi = idx < 256 ? quarter_sine[idx + 1] : lo;
+    float result = (lo + (hi - lo) * (within & 0x3FFF) * (1.0f / 0x4000)) *
+                   (1.0f / 32768);
+    return quadrant & 2 ? -result : result;
+}
+
+// 2 pi in three parts for Cody-Waite range reduction. The first has 8
+// significant bits so k * TWO_PI_1 and x - k * TWO_PI_1 are exact for
+// |k| < 2^16, and the other two make up what it leaves out.
+#define TWO_PI_1 6.28125f
+#define TWO_PI_2 1.935307169e-3f
+#define TWO_PI_3 1.025313168e-11f
+
+// convert radians into 2^24ths of a turn
+static uint32_t turns(float x) {
+    // bring x into [-pi, pi] first, otherwise the multiply below rounds off
+    // more of the angle the bigger x is
+    int32_t k = (int32_t)(x * (1 / (2 * PI)) + (x < 0 ? -0.5f : 0.5f));
+    float r = x - k * TWO_PI_1 - k * TWO_PI_2 - k * TWO_PI_3;
+    return (int32_t)(r * (16777216 / (2 * PI)));
+}
+
+float sin(float x) {
+    return interpolate_sine(turns(x));
+}
+
+float cos(float x) {
+    return interpolate_sine(turns(x) + (1 << 22));
+}
+
+int16_t sin_q15(uint16_t angle) {
+    uint32_t quadrant = angle >> 14;
+    uint32_t within = angle & 0x3FFF;
+    if (quadrant & 1) {
+        within = 0x4000 - within;
+    }
+    uint32_t idx = within >> 6;
+    int32_t lo = quarter_sine[idx];
+    int32_t hi = idx < 256 ? quarter_sine[idx + 1] : lo;
+    int32_t result = lo + ((hi - lo) * (int32_t)(within & 63) >> 6);
+    if (result > INT16_MAX) { // +1.0 saturates, -1.0 is fine
+        result = INT16_MAX;
+        return quadrant & 2 ? INT16_MIN : result;
+    }
+    return quadrant & 2 ? -result : result;
+}
+
+int16_t cos_q15(uint16_t angle) {
+    return sin_q15(angle + 16384);
+}
+
+float sqrtf(float x) {
+#ifdef __ARM_FP
+    __asm("vsqrt.f32 %0, %1" : "=t"(x) : "t"(x));
+    return x;
+#else // the host build in test/
+    return __builtin_sqrtf(x);
+#endif
+}
+
+uint32_t isqrt(uint32_t x) {
+    uint32_t root = 0;
+    for (uint32_t bit = 1u << 30; bit; bit >>= 2) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+// minimax polynomial for atan on [-1, 1]
+static float atan_unit(float z) {
+    float z2 = z * z;
+    return z * (0.99997726f +
+                z2 * (-0.33262347f +
+                      z2 * (0.19354346f +
+                            z2 * (-0.11643287f +
+                                  z2 * (0.05265332f + z2 * -0.01172120f)))));
+}
+
+float atan2f(float y, float x) {
+    float ax = x < 0 ? -x : x;
+    float ay = y < 0 ? -y : y;
+    if (ax == 0 && ay == 0) {
+        return 0;
+    }
+    // keep the polynomial's argument in [-1, 1]
+    float angle =
+        ay > ax ? PI / 2 - atan_unit(ax / ay) : atan_unit(ay / ax);
+    if (x < 0) {
+        angle = PI - angle;
+    }
+    return y < 0 ? -angle : angle;
+}
+
+static float from_bits(uint32_t bits) {
+    float x;
+    __builtin_memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+static uint32_t to_bits(float x) {
+    uint32_t bits;
+    __builtin_memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+// ln(2) split so that k * LN2_HI is exact for the exponents a float can have
+#define LN2 0.69314718f
+#define LN2_HI 0.693145752f
+#define LN2_LO 1.42860677e-6f
+
+float expf(float x) {
+    if (x > 88.7228394f) { // ln(FLT_MAX)
+        return __builtin_inff();
+    }
+    if (x < -87.33f) {
+        return 0;
+    }
+    // e^x = 2^k * e^r with |r| <= ln(2)/2
+    int32_t k = (int32_t)(x * (1 / LN2) + (x < 0 ? -0.5f : 0.5f));
+    float r = x - k * LN2_HI - k * LN2_LO;
+    float p =
+        1 + r * (1 + r * (0.5f + r * (1.0f / 6 +
+                                      r * (1.0f / 24 +
+                                           r * (1.0f / 120 + r / 720)))));
+    if (k > 127) { // 2^128 isn't a float, but p * 2 * 2^127 can be
+        p *= 2;
+        k--;
+    }
+    return p * from_bits((uint32_t)(k + 127) << 23);
+}
+
+float logf(float x) {
+    if (x < 0) {
+        return __builtin_nanf("");
+    }
+    if (x == 0) {
+        return -__builtin_inff();
+    }
+    // x = m * 2^e with m in [sqrt(1/2), sqrt(2))
+    uint32_t bits = to_bits(x);
+    int32_t e = (int32_t)(bits >> 23) - 127;
+    float m = from_bits((bits & 0x7FFFFF) | 0x3F800000);
+    if (m > 1.41421356f) {
+        m *= 0.5f;
+        e++;
+    }
+    // ln(m) = 2 atanh(s) with s = (m - 1) / (m + 1), |s| < 0.172
+    float s = (m - 1) / (m + 1);
+    float s2 = s * s;
+    float ln_m =
+        2 * s *
+        (1 + s2 * (1.0f / 3 + s2 * (1.0f / 5 + s2 * (1.0f / 7 + s2 / 9))));
+    return ln_m + e * LN2_LO + e * LN2_HI;
+}
@@ -2,6 +2,11 @@
 #include "OS.h"
 #include "heap.h"
 
+// flags in FIFO.events, set on the transitions that a blocked reader or writer
+// could be waiting for
+#define FIFO_DATA 1
+#define FIFO_SPACE 2
+
 FIFO* fifo_new(uint16_t size) {
     if (size & size - 1) { // Size must be power of 2
         return 0;
@@ -17,12 +22,13 @@ FIFO* fifo_new(uint16_t size) {
         return 0;
     }
     temp->putidx = temp->getidx = 0;
-    OS_InitSemaphore(&temp->data_available, -1);
+    OS_InitEvents(&temp->events);
     return temp;
 }
 
 void fifo_clear(FIFO* fifo) {
     fifo->putidx = fifo->getidx = 0;
+    OS_SetEvents(&fifo->events, FIFO_SPACE);
 }
 
 void fifo_free(FIFO* fifo) {
@@ -31,23 +37,42 @@ void fifo_free(FIFO* fifo) {
 }
 
 void fifo_put(FIFO* fifo, uint8_t n) {
-    while (!fifo_space(fifo)) { OS_Suspend(); }
-    fifo_try_put(fifo, n);
+    while (!fifo_try_put(fifo, n)) {
+        OS_WaitEvents(&fifo->events, FIFO_SPACE, false, true, 0);
+    }
 }
 
 uint8_t fifo_get(FIFO* fifo) {
-    OS_Wait(&fifo->data_available);
     uint8_t temp;
-    fifo_try_get(fifo, &temp);
+    fifo_get_timeout(fifo, &temp, 0);
     return temp;
 }
 
+bool fifo_get_timeout(FIFO* fifo, uint8_t* out, uint32_t timeout) {
+    uint32_t deadline = OS_Time() + timeout;
+    while (!fifo_try_get(fifo, out)) {
+        uint32_t remaining = 0;
+        if (timeout) {
+            remaining = deadline - OS_Time();
+            if ((int32_t)remaining <= 0) {
+                return false;
+            }
+        }
+        OS_WaitEvents(&fifo->events, FIFO_DATA, false, true, remaining);
+    }
+    return true;
+}
+
 bool fifo_try_put(FIFO* fifo, uint8_t n) {
     if (fifo_full(fifo)) {
         return false;
     }
+    bool was_empty = fifo_empty(fifo);
     fifo->buf[fifo->putidx++] = n;
     fifo->putidx &= fifo->size;
+    if (was_empty) {
+        OS_SetEvents(&fifo->events, FIFO_DATA);
+    }
     return true;
 }
 
@@ -55,8 +80,12 @@ bool fifo_try_get(FIFO* fifo, uint8_t* out) {
     if (fifo_empty(fifo)) {
         return false;
     }
+    bool was_full = fifo_full(fifo);
     *out = fifo->buf[fifo->getidx++];
     fifo->getidx &= fifo->size;
+    if (was_full) {
+        OS_SetEvents(&fifo->events, FIFO_SPACE);
+    }
     return true;
 }
 
@@ -5,11 +5,17 @@
 #include "heap.h"
 #include "io.h"
 #include "launchpad.h"
+#include "lfs_util.h"
 #include "littlefs.h"
+#include "log.h"
 #include "mouse.h"
 #include "printf.h"
+#include "reader.h"
+#include "sha256.h"
 #include "std.h"
 #include "timer.h"
+#include "trace.h"
+#include "transfer.h"
 #include <stdint.h>
 
 #define ERROR(...)                                                             \
@@ -40,23 +46,31 @@ static char* HELPSTRING =
     "time [get/reset]\t\tOS time helpers\n\n\r"
 
 #ifdef TRACK_JITTER
-    "jitter\t\t\t\tshow periodic task jitter stats\n\r"
+    "jitter [reset/dump]\t\tshow periodic task jitter stats\n\r"
 #endif
-    "heap\t\t\t\tshow heap usage information\n\n\r"
+    "rt\t\t\t\tshow realtime thread deadline stats\n\r"
+    "heap\t\t\t\tshow heap usage information\n\r"
+    "log [start/clear]\t\tdump the binary trace log\n\r"
+#ifdef TRACE_KERNEL
+    "trace [clear/save FILE]\t\tdump the kernel event trace\n\r"
+#endif
+    "\n\r"
 
     "mount\t\t\t\tmount the sd card\n\r"
     "unmount\t\t\t\tunmount the sd card\n\r"
     "format yes really\t\tformat the sd card\n\r"
-    "upload FILENAME\t\t\ttransfer a file over UART\n\r"
+    "upload FILENAME [BAUD/paste]\treceive a file from userprog/transfer.py\n\r"
+    "download FILENAME [OFFSET]\tsend a file to userprog/download.py\n\r"
+    "sync\t\t\t\tlist files for userprog/download.py\n\r"
     "exec FILENAME\t\t\tload and run process from file\n\r"
     "touch FILENAME\t\t\tcreates a new file\n\r"
     "cat FILENAME\t\t\tdisplay the contents of a file\n\r"
     "append FILENAME WORD\t\tappend a word to a file\n\r"
     "ls\t\t\t\tlist the files in the directory\n\r"
     "mv FILENAME NEWNAME\t\tmove a file\n\r"
-    "cp FILENAME NEWNAME\t\tcopy a file\n\r"
+    "cp FILENAME NEWNAME\t\tcopy a file, replacing NEWNAME\n\r"
     "rm FILENAME\t\t\tdelete a file\n\r"
-    "checksum FILENAME\t\tcompute a checksum of a file\n\n\r"
+    "checksum FILENAME [sha256]\tCRC-32 of a file and the read speed\n\n\r"
 
     "connect [SSID PASS]\t\tconnect to a wifi network.\n\r"
     "server\t\t\t\tspawn remote interpreter\n\r"
@@ -84,6 +98,7 @@ static char* MOUSEHELP =
     "stops all mouse movement, and releases all mouse buttons\n\r";
 
 static uint32_t server_id = 0;
+static uint32_t mouse_server_id = 0;
 static void server(void) {
     server_id = OS_Id();
     if (!ESP8266_StartServer(23, 600)) { // port 23, 5min timeout
@@ -96,11 +111,12 @@ static void server(void) {
         puts("Connected");
         interpreter(true);
         ESP8266_CloseTCPConnection();
+        OS_RedirectOutput(UART);
     }
 }
 
 static void mouse_server(void) {
-    server_id = OS_Id();
+    mouse_server_id = OS_Id();
     if (!ESP8266_StartServer(23, 600)) {
         ERROR("Server failure");
         OS_Kill();
@@ -114,9 +130,121 @@ static void mouse_server(void) {
     ESP8266_Receive(msg, 3);
     while (mouse_cmd(msg[0])) { ESP8266_Receive(msg, 3); }
     ESP8266_CloseTCPConnection();
+    mouse_server_id = 0;
     OS_Kill();
 }
 
+// the listing userprog/download.py reads for sync
+static void sync_file(const char* name, uint32_t size, void* arg) {
+    printf("@S %s %d\n\r", name, size);
+}
+
+// CRC-32 (and SHA-256 if asked) of a file read a block at a time, which
+// doubles as a benchmark of filesystem reads
+static void checksum(const char* name, bool sha) {
+    if (!littlefs_open_file(name, false)) {
+        ERROR("couldn't open file '%s'\n\r", name);
+    }
+    uint8_t* buf = malloc(LITTLEFS_BLOCK_SIZE);
+    Sha256* ctx = sha ? malloc(sizeof(Sha256)) : 0;
+    if (!buf || (sha && !ctx)) {
+        if (buf) {
+            free(buf);
+        }
+        littlefs_close_file();
+        ERROR("out of memory\n\r");
+    }
+    if (sha) {
+        sha256_init(ctx);
+    }
+    uint32_t crc = 0xffffffff; // lfs_crc is CRC-32 without the inversions
+    uint32_t size = 0;
+    int32_t n;
+    uint32_t start = OS_Time();
+    while ((n = littlefs_read_buffer(buf, LITTLEFS_BLOCK_SIZE)) > 0) {
+        crc = lfs_crc(crc, buf, n);
+        if (sha) {
+            sha256_update(ctx, buf, n);
+        }
+        size += n;
+    }
+    uint32_t elapsed = OS_Time() - start;
+    littlefs_close_file();
+    free(buf);
+    if (n < 0) {
+        if (ctx) {
+            free(ctx);
+        }
+        ERROR("failed to read the file\n\r");
+    }
+    printf("crc32  %08x\n\r", crc ^ 0xffffffff);
+    if (sha) {
+        uint8_t digest[32];
+        char hex[65];
+        sha256_final(ctx, digest);
+        free(ctx);
+        for (uint8_t i = 0; i < 32; i++) {
+            snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+        }
+        printf("sha256 %s\n\r", hex);
+    }
+    printf("%d bytes in %d ms (%d bytes/s)\n\r", size, to_us(elapsed) / 1000,
+           elapsed ? (uint32_t)(size / to_seconds(elapsed)) : 0);
+}
+
+// several blocks per read and write, or one if that's too much
+#define COPY_BUFFER (4 * LITTLEFS_BLOCK_SIZE)
+
+// the copy is written under a temporary name and renamed over to at the end,
+// so a failed copy leaves an existing to as it was
+static void copy(const char* from, const char* to) {
+    char temp[LITTLEFS_NAME_MAX + 2];
+    if (snprintf(temp, sizeof(temp), "%s~", to) > LITTLEFS_NAME_MAX) {
+        ERROR("'%s' is too long to copy to\n\r", to);
+    }
+    if (streq(from, temp)) {
+        ERROR("can't copy '%s' through itself\n\r", from);
+    }
+    LittleFile* in = littlefs_open(from, false);
+    if (!in) {
+        ERROR("couldn't open file '%s'\n\r", from);
+    }
+    LittleFile* out = littlefs_open(temp, true);
+    if (!out) {
+        littlefs_close(in);
+        ERROR("couldn't create file '%s'\n\r", temp);
+    }
+    uint32_t len = COPY_BUFFER;
+    uint8_t* buf = malloc(len);
+    if (!buf) {
+        len = LITTLEFS_BLOCK_SIZE;
+        buf = malloc(len);
+    }
+    bool ok = buf;
+    uint32_t size = 0;
+    uint32_t start = OS_Time();
+    int32_t n;
+    while (ok && (n = littlefs_file_read(in, buf, len)) > 0) {
+        ok = littlefs_file_write(out, buf, n) == n;
+        size += n;
+    }
+    ok = ok && n == 0;
+    littlefs_close(in);
+    ok = littlefs_close(out) && ok; // the last block is written on close
+    ok = ok && littlefs_move(temp, to);
+    uint32_t elapsed = OS_Time() - start;
+    if (buf) {
+        free(buf);
+    }
+    if (!ok) {
+        littlefs_remove(temp);
+        ERROR("failed to copy '%s'\n\r", from);
+    }
+    printf("Copied %d bytes in %d ms (%d bytes/s)\n\r", size,
+           to_us(elapsed) / 1000,
+           elapsed ? (uint32_t)(size / to_seconds(elapsed)) : 0);
+}
+
 static char* temp_ip;
 static void client(void) {
     if (!ESP8266_MakeTCPConnection(temp_ip, 23)) {
@@ -124,6 +252,8 @@ static void client(void) {
         OS_Kill();
     }
     free(temp_ip);
+    // skip the AT framing when we have the module to ourselves
+    ESP8266_StartPassthrough();
     puts("Client started");
 
     char* raw_command = malloc(COMMAND_BUF_LEN);
@@ -170,9 +300,47 @@ void interpret_command(char* raw_command, char* token, bool remote) {
     } else if (streq(token, "temp")) {
         printf("%d degrees F\n\r", (int32_t)temperature());
     } else if (streq(token, "jitter")) {
-        OS_ReportJitter();
+        if (!next_token(&current, token)) {
+            OS_ReportJitter();
+        } else if (streq(token, "reset")) {
+            OS_ResetJitter();
+        } else if (streq(token, "dump")) {
+            OS_DumpJitter();
+        } else {
+            ERROR("expected 'reset' or 'dump', got '%s'\n\r", token);
+        }
+    } else if (streq(token, "rt")) {
+        OS_ReportRealtime();
     } else if (streq(token, "heap")) {
         heap_stats();
+    } else if (streq(token, "log")) {
+        if (!next_token(&current, token)) {
+            log_dump();
+        } else if (streq(token, "start")) {
+            if (!log_init(64)) {
+                ERROR("couldn't allocate the log\n\r");
+            }
+        } else if (streq(token, "clear")) {
+            log_clear();
+        } else {
+            ERROR("expected 'start' or 'clear', got '%s'\n\r", token);
+        }
+#ifdef TRACE_KERNEL
+    } else if (streq(token, "trace")) {
+        if (!next_token(&current, token)) {
+            trace_dump();
+        } else if (streq(token, "clear")) {
+            trace_clear();
+        } else if (streq(token, "save")) {
+            if (!next_token(&current, token)) {
+                ERROR("must pass a filename\n\r");
+            } else if (!trace_save(token)) {
+                ERROR("couldn't write '%s'\n\r", token);
+            }
+        } else {
+            ERROR("expected 'clear' or 'save', got '%s'\n\r", token);
+        }
+#endif
     } else if (streq(token, "time")) {
         if (!next_token(&current, token) || streq(token, "get")) {
             printf("Current time: %dms\n\r", (uint32_t)to_ms(OS_Time()));
@@ -212,10 +380,26 @@ void interpret_command(char* raw_command, char* token, bool remote) {
         } else if (!littlefs_open_file(token, false)) {
             ERROR("couldn't open file '%s'\n\r", token);
         }
-        char temp;
-        while (littlefs_read((uint8_t*)&temp)) { putchar(temp); }
-        printf("\n\r");
+        Reader r;
+        if (!reader_init(&r, 0)) {
+            littlefs_close_file();
+            ERROR("out of memory\n\r");
+        }
+        // a line at a time so each can end with the \r the terminal wants
+        const uint8_t* line;
+        int32_t n;
+        while ((n = reader_next(&r, '\n', &line)) > 0) {
+            OS_RedirectWrite((const char*)line, n);
+            if (line[n - 1] == '\n') {
+                putchar('\r');
+            }
+        }
+        reader_free(&r);
         littlefs_close_file();
+        if (n < 0) {
+            ERROR("\n\rfailed to read the file\n\r");
+        }
+        printf("\n\r");
     } else if (streq(token, "append")) {
         if (!next_token(&current, token)) {
             ERROR("must pass a filename\n\r");
@@ -226,7 +410,7 @@ void interpret_command(char* raw_command, char* token, bool remote) {
             ERROR("must pass some characters to append\n\r");
         }
         uint8_t len = strlen(token);
-        bool ret = littlefs_write_buffer(token, len);
+        bool ret = littlefs_write_buffer(token, len) == len;
         littlefs_close_file();
         if (!ret) {
             ERROR("failed to write to the file\n\r");
@@ -250,8 +434,19 @@ void interpret_command(char* raw_command, char* token, bool remote) {
             ERROR("failed to move file\n\r");
         }
     } else if (streq(token, "cp")) {
-        // TODO
-        ERROR("unimplemented\n\r");
+        if (!next_token(&current, token)) {
+            ERROR("must pass a filename\n\r");
+        } else if (strlen(token) > LITTLEFS_NAME_MAX) {
+            ERROR("'%s' is too long\n\r", token);
+        }
+        char filename[LITTLEFS_NAME_MAX + 1];
+        strcpy(filename, token);
+        if (!next_token(&current, token)) {
+            ERROR("must pass another filename\n\r");
+        } else if (streq(filename, token)) {
+            ERROR("can't copy a file onto itself\n\r");
+        }
+        copy(filename, token);
     } else if (streq(token, "exec")) {
         if (!next_token(&current, token)) {
             ERROR("must pass a filename\n\r");
@@ -262,58 +457,68 @@ void interpret_command(char* raw_command, char* token, bool remote) {
         if (!next_token(&current, token)) {
             ERROR("must pass a filename\n\r");
         }
-        if (!littlefs_open_file(token, true)) {
-            ERROR("failed to open file\n\r");
-        }
-        puts("Are you using the file transfer utility? [Y/n]");
-        bool file_transfer = !(getchar() == 'n');
-        bool binary = false;
-        if (file_transfer) {
-            puts("Is the file you're transferring binary? [y/N]");
-            binary = getchar() == 'y';
+        char name[32];
+        strcpy(name, token);
+        bool paste = false;
+        uint32_t baud = 0;
+        if (next_token(&current, token)) {
+            paste = streq(token, "paste");
+            baud = paste ? 0 : atoi(token);
         }
-        char sizebuf[16];
-        if (file_transfer) {
-            puts("Close this session and run the file transfer utility...");
-            uart_change_speed(9600);
-        } else {
+        if (paste) {
+            if (!littlefs_open_file(name, true)) {
+                ERROR("failed to open file\n\r");
+            }
+            char sizebuf[16];
             printf("Enter your file's size in bytes: ");
-        }
-        readline(sizebuf, sizeof(sizebuf));
-        uint32_t size = atoi(sizebuf);
-        if (!file_transfer) {
+            readline(sizebuf, sizeof(sizebuf));
+            uint32_t size = atoi(sizebuf);
             puts("Now paste the contents of your file...");
-        }
-        while (size--) {
-            char temp = getchar();
-            if (!littlefs_write(temp)) {
-                littlefs_close_file();
-                ERROR("failed to write to the file\n\r");
-                if (file_transfer) {
-                    __asm("BKPT");
+            while (size--) {
+                char temp = getchar();
+                if (!littlefs_write(temp)) {
+                    littlefs_close_file();
+                    ERROR("failed to write to the file\n\r");
+                }
+                // translate to CRLF line endings
+                if (temp == '\r' || temp == '\n') {
+                    littlefs_write(temp == '\n' ? '\r' : '\n');
                 }
             }
-            // translate to CRLF line endings
-            if (!binary && (temp == '\r' || temp == '\n')) {
-                littlefs_write(temp == '\n' ? '\r' : '\n');
+            puts("Successfully Uploaded!");
+            littlefs_close_file();
+        } else {
+            puts("Waiting for userprog/transfer.py...");
+            int32_t size = transfer_receive(name, baud);
+            if (size < 0) {
+                ERROR("upload failed\n\r");
             }
+            printf("Received %d bytes\n\r", size);
         }
-        if (file_transfer) {
-            uart_change_speed(115200);
+    } else if (streq(token, "download")) {
+        if (!next_token(&current, token)) {
+            ERROR("must pass a filename\n\r");
         }
-        puts("Successfully Uploaded!");
-        littlefs_close_file();
+        char name[32];
+        strcpy(name, token);
+        uint32_t offset = next_token(&current, token) ? atoi(token) : 0;
+        int32_t sent = transfer_send(name, offset, remote);
+        if (sent < 0) {
+            ERROR("download failed\n\r");
+        }
+        printf("Sent %d bytes\n\r", sent);
+    } else if (streq(token, "sync")) {
+        if (!littlefs_each(sync_file, 0)) {
+            ERROR("couldn't list the files\n\r");
+        }
+        puts("@S done");
     } else if (streq(token, "checksum")) {
         if (!next_token(&current, token)) {
             ERROR("must pass a filename\n\r");
-        } else if (!littlefs_open_file(token, false)) {
-            ERROR("couldn't open file '%s'\n\r", token);
         }
-        char temp;
-        uint32_t checksum = 0;
-        while (littlefs_read((uint8_t*)&temp)) { checksum += temp; }
-        printf("0x%08x\n\r", checksum);
-        littlefs_close_file();
+        char name[32];
+        strcpy(name, token);
+        checksum(name, next_token(&current, token) && streq(token, "sha256"));
     } else if (streq(token, "connect")) {
         if (next_token(&current, token)) {
             ERROR("Unimplimented\n\r");
@@ -329,6 +534,9 @@ void interpret_command(char* raw_command, char* token, bool remote) {
         }
         wifi = true;
         puts("Wifi connected");
+        if (!ESP8266_SetBaud(921600, false)) {
+            printf("ESP staying at %d baud\n\r", ESP8266_Baud());
+        }
     } else if (streq(token, "server")) {
         if (server_id) {
             ERROR("Server already running\n\r");
@@ -350,7 +558,9 @@ void interpret_command(char* raw_command, char* token, bool remote) {
         free(raw_command);
         OS_Kill();
     } else if (streq(token, "mouse_server")) {
-        if (!wifi) {
+        if (mouse_server_id) {
+            ERROR("Mouse server already running\n\r");
+        } else if (!wifi) {
             ERROR("Connect to a wifi network\n\r");
         }
         OS_AddThread(mouse_server, "mouse_server", 2048, 2);
@@ -386,6 +596,15 @@ void interpret_command(char* raw_command, char* token, bool remote) {
     }
 }
 
+// returns false if the remote connection closed
+static bool read_command(char* raw_command, bool remote) {
+    if (remote) {
+        return ESP8266_Receive(raw_command, COMMAND_BUF_LEN);
+    }
+    readline(raw_command, COMMAND_BUF_LEN);
+    return true;
+}
+
 void interpreter(bool remote) {
     char* token = malloc(32);
     char* raw_command = malloc(COMMAND_BUF_LEN);
@@ -393,10 +612,10 @@ void interpreter(bool remote) {
         OS_RedirectOutput(ESP);
     }
     printf("\x1b[1;1H\x1b[2JPress Enter to begin...\x03");
-    if (remote) {
-        ESP8266_Receive(raw_command, COMMAND_BUF_LEN);
-    } else {
-        readline(raw_command, COMMAND_BUF_LEN);
+    if (!read_command(raw_command, remote)) {
+        free(token);
+        free(raw_command);
+        return;
     }
     puts(HELPSTRING);
     if (littlefs_init() && littlefs_mount()) {
@@ -406,11 +625,11 @@ void interpreter(bool remote) {
     }
     while (true) {
         printf("\n\r\xF0\x9F\x8D\x8D> \x03");
-        if (remote) {
-            ESP8266_Receive(raw_command, COMMAND_BUF_LEN);
-        } else {
-            readline(raw_command, COMMAND_BUF_LEN);
+        if (!read_command(raw_command, remote)) {
+            break;
         }
-        interpret_command(raw_command, token, true);
+        interpret_command(raw_command, token, remote);
     }
+    free(token);
+    free(raw_command);
 }
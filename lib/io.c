@@ -9,6 +9,7 @@
 #include "tivaware/rom.h"
 #include "tivaware/sysctl.h"
 #include "tivaware/uart.h"
+#include "trace.h"
 #include <stdarg.h>
 #include <stdint.h>
 
@@ -35,6 +36,7 @@ static void sw_to_hw_fifo() {
 }
 
 void uart0_handler(void) {
+    TRACE_ISR_ENTER();
     uint32_t source = ROM_UARTIntStatus(UART0_BASE, false);
     if (source & (UART_INT_RX | UART_INT_RT)) {
         ROM_UARTIntClear(UART0_BASE, UART_INT_RX | UART_INT_RT);
@@ -44,6 +46,7 @@ void uart0_handler(void) {
         ROM_UARTIntClear(UART0_BASE, UART_INT_TX);
         sw_to_hw_fifo();
     }
+    TRACE_ISR_EXIT();
 }
 
 void uart_init(void) {
@@ -71,6 +74,9 @@ void uart_init(void) {
 }
 
 void uart_change_speed(uint32_t baud) {
+    // let what's already written go out at the old rate
+    while (!fifo_empty(txfifo)) { OS_Suspend(); }
+    while (ROM_UARTBusy(UART0_BASE)) {}
     ROM_UARTConfigSetExpClk(UART0_BASE, ROM_SysCtlClockGet(), baud,
                             UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE |
                                 UART_CONFIG_PAR_NONE);
@@ -97,9 +103,31 @@ bool uart_putchar(char x) {
 }
 
 char getchar(void) {
-    uint8_t temp;
-    while (!fifo_try_get(rxfifo, &temp)) { OS_Suspend(); };
-    return temp;
+    return fifo_get(rxfifo);
+}
+
+uint32_t uart_read(void* buf, uint32_t len, uint32_t timeout) {
+    uint8_t* out = buf;
+    uint32_t n = 0;
+    while (n < len && fifo_get_timeout(rxfifo, out + n, timeout)) { n++; }
+    return n;
+}
+
+bool uart_rx_size(uint16_t size) {
+    FIFO* fifo = fifo_new(size);
+    if (!fifo) {
+        return false;
+    }
+    uint32_t crit = start_critical();
+    FIFO* old = rxfifo;
+    rxfifo = fifo;
+    end_critical(crit);
+    fifo_free(old);
+    return true;
+}
+
+void uart_write(const char* buf, uint32_t len) {
+    while (len--) { uart_putchar(*buf++); }
 }
 
 void uart_puts(const char* str) {
@@ -4,21 +4,21 @@
 #include "interpreter.h"
 #include "io.h"
 #include "lfs.h"
+#include "littlefs.h"
 #include "printf.h"
 
-#define BLOCK_SIZE 512
 
-const static uint8_t erase_buffer[BLOCK_SIZE] = {0};
+const static uint8_t erase_buffer[LITTLEFS_BLOCK_SIZE] = {0};
 
 static int block_prog(const struct lfs_config* c, lfs_block_t block,
                       lfs_off_t off, const void* buffer, lfs_size_t size) {
-    eDisk_Write(buffer, block, size / BLOCK_SIZE);
+    eDisk_Write(buffer, block, size / LITTLEFS_BLOCK_SIZE);
     return 0;
 }
 
 static int block_read(const struct lfs_config* c, lfs_block_t block,
                       lfs_off_t off, void* buffer, lfs_size_t size) {
-    eDisk_Read(buffer, block, size / BLOCK_SIZE);
+    eDisk_Read(buffer, block, size / LITTLEFS_BLOCK_SIZE);
     return 0;
 }
 
@@ -43,15 +43,15 @@ static const struct lfs_config cfg = {
     .sync = sync,
 
     // block device configuration
-    .read_size = BLOCK_SIZE,
-    .prog_size = BLOCK_SIZE,
-    .block_size = BLOCK_SIZE,
+    .read_size = LITTLEFS_BLOCK_SIZE,
+    .prog_size = LITTLEFS_BLOCK_SIZE,
+    .block_size = LITTLEFS_BLOCK_SIZE,
     .block_count = 1 << 21, // 1GiB
-    .cache_size = BLOCK_SIZE,
+    .cache_size = LITTLEFS_BLOCK_SIZE,
     .lookahead_size = 32,
     .block_cycles = 500,
 
-    .name_max = 63,
+    .name_max = LITTLEFS_NAME_MAX,
 };
 
 bool littlefs_init(void) {
@@ -87,34 +87,6 @@ bool littlefs_read(uint8_t* output) {
     return lfs_file_read(lfs, file, output, 1) == 1;
 }
 
-uint16_t littlefs_read_line(char* str, uint16_t len) {
-    int received = 0;
-    char current = '\0';
-    while (len--) {
-        if (!littlefs_read((uint8_t*)&current)) {
-            *str++ = '\n';
-            *str = '\0';
-            return 0;
-        }
-        switch (current) {
-        case '\n':
-        case '\r':
-            *str++ = '\n';
-            *str = '\0';
-            return ++received;
-        case 127:
-            if (received > 0) {
-                --str;
-                --received;
-            }
-            break;
-        default: *str++ = current; ++received;
-        }
-    }
-    *--str = '\0';
-    return received;
-}
-
 int32_t littlefs_read_buffer(void* buffer, uint32_t size) {
     return lfs_file_read(lfs, file, buffer, size);
 }
@@ -127,14 +99,49 @@ int32_t littlefs_tell() {
     return lfs_file_tell(lfs, file);
 }
 
+int32_t littlefs_size(void) {
+    return lfs_file_size(lfs, file);
+}
+
 int32_t littlefs_write_buffer(void* buffer, uint32_t size) {
-    return lfs_file_write(lfs, file, buffer, size) >= 0;
+    return lfs_file_write(lfs, file, buffer, size);
 }
 
 bool littlefs_close_file(void) {
     return lfs_file_close(lfs, file) >= 0;
 }
 
+LittleFile* littlefs_open(const char* name, bool write) {
+    LittleFile* f = malloc(sizeof(LittleFile));
+    if (!f) {
+        return 0;
+    }
+    int flags = write ? LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC : LFS_O_RDONLY;
+    if (lfs_file_open(lfs, f, name, flags) < 0) {
+        free(f);
+        return 0;
+    }
+    return f;
+}
+
+int32_t littlefs_file_read(LittleFile* f, void* buffer, uint32_t size) {
+    return lfs_file_read(lfs, f, buffer, size);
+}
+
+int32_t littlefs_file_write(LittleFile* f, const void* buffer, uint32_t size) {
+    return lfs_file_write(lfs, f, buffer, size);
+}
+
+int32_t littlefs_file_size(LittleFile* f) {
+    return lfs_file_size(lfs, f);
+}
+
+bool littlefs_close(LittleFile* f) {
+    bool ok = lfs_file_close(lfs, f) >= 0;
+    free(f);
+    return ok;
+}
+
 bool littlefs_unmount(void) {
     return lfs_unmount(lfs) >= 0;
 }
@@ -151,7 +158,8 @@ bool littlefs_write(uint8_t c) {
     return lfs_file_write(lfs, file, &c, 1) >= 0;
 }
 
-bool littlefs_ls(void) {
+bool littlefs_each(void (*each)(const char* name, uint32_t size, void* arg),
+                   void* arg) {
     lfs_dir_t dir;
     if (lfs_dir_open(lfs, &dir, "")) { // empty name for root dir
         return false;
@@ -166,11 +174,19 @@ bool littlefs_ls(void) {
         } else if (info.type == LFS_TYPE_DIR) {
             continue; // we are only concerned with the root
         }
-        printf("%-32s %d bytes\n\r", info.name, info.size);
+        each(info.name, info.size, arg);
     }
     return !lfs_dir_close(lfs, &dir);
 }
 
+static void print_file(const char* name, uint32_t size, void* arg) {
+    printf("%-32s %d bytes\n\r", name, size);
+}
+
+bool littlefs_ls(void) {
+    return littlefs_each(print_file, 0);
+}
+
 void littlefs_test(void) {
     if (littlefs_init()) {
         printf("error: edisk init\n\r");
@@ -0,0 +1,96 @@
+#include "log.h"
+#include "heap.h"
+#include "interrupts.h"
+#include "io.h"
+#include "printf.h"
+#include "tivaware/hw_memmap.h"
+#include "tivaware/hw_timer.h"
+#include "tivaware/hw_types.h"
+#include <stdint.h>
+
+typedef struct {
+    const char* format;
+    uint32_t time;
+    uint32_t args[4];
+    uint32_t seq; // index + 1 once the record is complete, 0 while writing
+} LogRecord;
+
+static LogRecord* log_ring;
+static uint32_t log_mask;
+static uint32_t log_idx; // total records claimed since the last clear
+
+bool log_init(uint16_t records) {
+    if (log_ring) {
+        return true;
+    }
+    if (!records || records & records - 1) {
+        return false;
+    }
+    LogRecord* ring = calloc(records * sizeof(LogRecord));
+    if (!ring) {
+        return false;
+    }
+    log_mask = records - 1;
+    __atomic_store_n(&log_ring, ring, __ATOMIC_RELEASE);
+    return true;
+}
+
+void log_write(const char* format, uint32_t a, uint32_t b, uint32_t c,
+               uint32_t d) {
+    LogRecord* ring = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE);
+    if (!ring) {
+        return;
+    }
+    // claiming the slot is the only shared write, so an interrupt that logs
+    // in the middle of this just gets the next one
+    uint32_t idx = __atomic_fetch_add(&log_idx, 1, __ATOMIC_RELAXED);
+    LogRecord* record = &ring[idx & log_mask];
+    record->seq = 0;
+    record->format = format;
+    // read the OS time directly, the ROM call costs more than the rest of this
+    record->time = HWREG(WTIMER5_BASE + TIMER_O_TAR);
+    record->args[0] = a;
+    record->args[1] = b;
+    record->args[2] = c;
+    record->args[3] = d;
+    __atomic_store_n(&record->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+void log_dump(void) {
+    if (!log_ring) {
+        puts("log not started");
+        return;
+    }
+    uint32_t end = __atomic_load_n(&log_idx, __ATOMIC_RELAXED);
+    uint32_t start = end > log_mask + 1 ? end - (log_mask + 1) : 0;
+    uint32_t skipped = 0;
+    printf("log: %d records, %d overwritten\n\r", end - start, start);
+    for (uint32_t i = start; i < end; ++i) {
+        // copy it out first so printing doesn't hold off interrupts
+        uint32_t crit = start_critical();
+        LogRecord record = log_ring[i & log_mask];
+        end_critical(crit);
+        // overwritten since we started, or a thread was preempted while
+        // writing it
+        if (record.seq != i + 1) {
+            skipped++;
+            continue;
+        }
+        printf("@L %08x %08x %08x %08x %08x %08x %08x\n\r", record.seq - 1,
+               record.time, (uint32_t)record.format, record.args[0],
+               record.args[1], record.args[2], record.args[3]);
+    }
+    if (skipped) {
+        printf("log: %d records changed while dumping\n\r", skipped);
+    }
+}
+
+void log_clear(void) {
+    if (!log_ring) {
+        return;
+    }
+    uint32_t crit = start_critical();
+    for (uint32_t i = 0; i <= log_mask; ++i) { log_ring[i].seq = 0; }
+    log_idx = 0;
+    end_critical(crit);
+}
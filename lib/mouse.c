@@ -1,5 +1,8 @@
 #include "mouse.h"
 #include "OS.h"
+#include "fastmath.h"
+#include "log.h"
+#include "pool.h"
 #include "printf.h"
 #include "std.h"
 #include "tivaware/gpio.h"
@@ -37,31 +40,38 @@ const uint8_t* const StringDescriptors[] = {
     SerialNumberString, HIDInterfaceString, ConfigString};
 
 static Sema4 mouse_ready;
+
+// the USB callbacks run in the USB interrupt, so printing is deferred
+static void print_usb_event(void* message) {
+    printf("\n%s\n\r", message);
+}
+
 uint32_t mouse_handler(void* pvCBData, uint32_t ui32Event, uint32_t ui32MsgData,
                        void* pvMsgData) {
     switch (ui32Event) {
     case USB_EVENT_CONNECTED: {
-        printf("\nHost Connected...\r\n");
+        OS_Defer(print_usb_event, "Host Connected...");
         OS_Signal(&mouse_ready);
         break;
     }
     case USB_EVENT_DISCONNECTED: {
-        printf("\nHost Disconnected...\r\n");
+        OS_Defer(print_usb_event, "Host Disconnected...");
         break;
     }
     case USB_EVENT_TX_COMPLETE: {
-        // printf("TX complete\n\r");
+        // once per report, so too often to print even when deferred
+        LOG("mouse TX complete");
         OS_Signal(&mouse_ready);
         break;
     }
     case USB_EVENT_SUSPEND: {
         OS_Signal(&mouse_ready);
-        printf("\nBus Suspended\n\r");
+        OS_Defer(print_usb_event, "Bus Suspended");
         break;
     }
     case USB_EVENT_RESUME: {
         OS_Signal(&mouse_ready);
-        printf("\nBus Resume\n\r");
+        OS_Defer(print_usb_event, "Bus Resume");
         break;
     }
         // We ignore all other events.
@@ -114,23 +124,23 @@ static char continuous_dir = ' ';
 static int8_t speed = 5;
 static bool circle = false;
 
+// runs once per frame as a realtime thread
 void mouse_continuous(void) {
-    while (true) {
-        OS_Sleep(hz(60));
-        switch (continuous_dir) {
-        case 'q': mouse_move(-speed, -speed); break;
-        case 'w': mouse_move(0, -speed); break;
-        case 'e': mouse_move(speed, -speed); break;
-        case 'a': mouse_move(-speed, 0); break;
-        case 'd': mouse_move(speed, 0); break;
-        case 'z': mouse_move(-speed, speed); break;
-        case 'x': mouse_move(0, speed); break;
-        case 'c': mouse_move(speed, speed); break;
-        }
+    switch (continuous_dir) {
+    case 'q': mouse_move(-speed, -speed); break;
+    case 'w': mouse_move(0, -speed); break;
+    case 'e': mouse_move(speed, -speed); break;
+    case 'a': mouse_move(-speed, 0); break;
+    case 'd': mouse_move(speed, 0); break;
+    case 'z': mouse_move(-speed, speed); break;
+    case 'x': mouse_move(0, speed); break;
+    case 'c': mouse_move(speed, speed); break;
     }
 }
 
-void mouse_circle(void) {
+static Job circle_job;
+
+static int32_t mouse_circle(void* arg) {
     const float f = 1; // in radians per second
     float t = 0;
     while (circle) {
@@ -141,6 +151,7 @@ void mouse_circle(void) {
         }
         OS_Sleep(hz(60));
     }
+    return 0;
 }
 
 void mouse_center(void) {
@@ -198,11 +209,11 @@ bool mouse_cmd(char c) {
     case 'c': continuous_dir = c; break;
     case 'O':
     case 'o':
-        if (circle) {
+        circle = !circle;
+        // if the last run is still going it just carries on
+        if (circle && circle_job.done.value >= 0 &&
+            !pool_try_submit(&circle_job, mouse_circle, 0)) {
             circle = false;
-        } else {
-            circle = true;
-            OS_AddThread(mouse_circle, "spin", 256, 2);
         }
         break;
     }
@@ -218,6 +229,7 @@ void mouse_init(void) {
         printf("error: hidmouseinit\n\r");
     }
     OS_Wait(&mouse_ready);
-    OS_AddThread(mouse_continuous, "Continuous mouse movement", 512, 2);
+    OS_AddRealtimeThread(mouse_continuous, "Continuous mouse movement", 512,
+                         hz(60), hz(60), us(500));
     OS_Sleep(seconds(1.5f));
 }
@@ -0,0 +1,109 @@
+#include "mq.h"
+#include "OS.h"
+#include "heap.h"
+#include "interrupts.h"
+#include <stdint.h>
+
+enum { SLOT_FREE, SLOT_RESERVED, SLOT_READY };
+
+MQueue* mq_new(uint16_t msg_size, uint16_t depth) {
+    if (!depth || depth & depth - 1) { // depth must be power of 2
+        return 0;
+    }
+    MQueue* mq = calloc(sizeof(MQueue));
+    if (!mq) {
+        return 0;
+    }
+    mq->msg_size = (msg_size + 3) & ~3; // keep every slot word aligned
+    mq->slots = malloc(mq->msg_size * depth);
+    if (!mq->slots) {
+        free(mq);
+        return 0;
+    }
+    mq->state = calloc(depth);
+    if (!mq->state) {
+        free(mq->slots);
+        free(mq);
+        return 0;
+    }
+    mq->mask = depth - 1;
+    OS_InitSemaphore(&mq->free, depth - 1);
+    OS_InitSemaphore(&mq->ready, -1);
+    return mq;
+}
+
+void mq_free(MQueue* mq) {
+    free(mq->slots);
+    free(mq->state);
+    free(mq);
+}
+
+static uint16_t slot_index(MQueue* mq, void* msg) {
+    return ((uint8_t*)msg - mq->slots) / mq->msg_size;
+}
+
+// called once a free slot has been claimed
+static void* take_free_slot(MQueue* mq) {
+    uint32_t crit = start_critical();
+    uint16_t idx = mq->reserve_idx++ & mq->mask;
+    mq->state[idx] = SLOT_RESERVED;
+    end_critical(crit);
+    return mq->slots + idx * mq->msg_size;
+}
+
+void* mq_reserve(MQueue* mq, uint32_t timeout) {
+    if (!OS_WaitTimeout(&mq->free, timeout)) {
+        return 0;
+    }
+    return take_free_slot(mq);
+}
+
+void* mq_try_reserve(MQueue* mq) {
+    uint32_t crit = start_critical();
+    if (mq->free.value < 0) {
+        end_critical(crit);
+        return 0;
+    }
+    --mq->free.value; // same as an OS_Wait that we know won't block
+    end_critical(crit);
+    return take_free_slot(mq);
+}
+
+void mq_commit(MQueue* mq, void* msg) {
+    uint32_t crit = start_critical();
+    mq->state[slot_index(mq, msg)] = SLOT_READY;
+    // a slower producer can hold up the ones that reserved after it, so
+    // publish every ready slot up to the first one still being written
+    while (mq->commit_idx != mq->reserve_idx &&
+           mq->state[mq->commit_idx & mq->mask] == SLOT_READY) {
+        mq->commit_idx++;
+        OS_Signal(&mq->ready);
+    }
+    end_critical(crit);
+}
+
+void* mq_receive(MQueue* mq, uint32_t timeout) {
+    if (!OS_WaitTimeout(&mq->ready, timeout)) {
+        return 0;
+    }
+    uint32_t crit = start_critical();
+    uint16_t idx = mq->receive_idx++ & mq->mask;
+    end_critical(crit);
+    return mq->slots + idx * mq->msg_size;
+}
+
+void mq_release(MQueue* mq, void* msg) {
+    uint32_t crit = start_critical();
+    mq->state[slot_index(mq, msg)] = SLOT_FREE;
+    // same as commit, slots go back to producers in order
+    while (mq->release_idx != mq->receive_idx &&
+           mq->state[mq->release_idx & mq->mask] == SLOT_FREE) {
+        mq->release_idx++;
+        OS_Signal(&mq->free);
+    }
+    end_critical(crit);
+}
+
+uint16_t mq_size(MQueue* mq) {
+    return mq->commit_idx - mq->receive_idx;
+}
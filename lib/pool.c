@@ -0,0 +1,103 @@
+#include "pool.h"
+#include "OS.h"
+#include "heap.h"
+#include "interrupts.h"
+#include <stdint.h>
+
+static Job** queue;
+static uint16_t putidx;
+static uint16_t getidx;
+static uint16_t mask;
+static Sema4 queued; // jobs waiting to be picked up
+static Sema4 space;  // free queue slots
+
+static void worker(void) {
+    while (true) {
+        OS_Wait(&queued);
+        uint32_t crit = start_critical();
+        Job* job = queue[getidx++];
+        getidx &= mask;
+        end_critical(crit);
+        OS_Signal(&space);
+        if (!job->task) { // told to stop by pool_init giving up
+            OS_Signal(&job->done);
+            OS_Kill();
+        }
+        job->result = job->task(job->arg);
+        OS_Signal(&job->done);
+    }
+}
+
+static void enqueue(Job* job, int32_t (*task)(void* arg), void* arg);
+
+// have the first count workers exit and free the queue so pool_init can be
+// tried again
+static void stop_workers(uint8_t count) {
+    Job stop;
+    while (count--) {
+        OS_Wait(&space); // the worker gives the slot back when it takes it
+        enqueue(&stop, 0, 0);
+        OS_Wait(&stop.done); // it's done with the queue once this is signaled
+    }
+    free(queue);
+    queue = 0;
+}
+
+bool pool_init(uint8_t workers, uint32_t stack_size, uint32_t priority,
+               uint16_t queue_size) {
+    if (queue || queue_size & (queue_size - 1)) {
+        return false;
+    }
+    queue = malloc(queue_size * sizeof(Job*));
+    if (!queue) {
+        return false;
+    }
+    putidx = getidx = 0;
+    mask = queue_size - 1;
+    OS_InitSemaphore(&queued, -1);
+    OS_InitSemaphore(&space, queue_size - 1);
+    for (int i = 0; i < workers; ++i) {
+        if (!OS_AddThread(worker, "Pool worker", stack_size, priority)) {
+            stop_workers(i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void enqueue(Job* job, int32_t (*task)(void* arg), void* arg) {
+    job->task = task;
+    job->arg = arg;
+    OS_InitSemaphore(&job->done, -1);
+    uint32_t crit = start_critical();
+    queue[putidx++] = job;
+    putidx &= mask;
+    end_critical(crit);
+    OS_Signal(&queued);
+}
+
+bool pool_submit(Job* job, int32_t (*task)(void* arg), void* arg) {
+    if (!queue) {
+        return false;
+    }
+    OS_Wait(&space);
+    enqueue(job, task, arg);
+    return true;
+}
+
+bool pool_try_submit(Job* job, int32_t (*task)(void* arg), void* arg) {
+    uint32_t crit = start_critical();
+    if (!queue || space.value < 0) {
+        end_critical(crit);
+        return false;
+    }
+    --space.value; // same as an OS_Wait that we know won't block
+    end_critical(crit);
+    enqueue(job, task, arg);
+    return true;
+}
+
+int32_t pool_wait(Job* job) {
+    OS_Wait(&job->done);
+    return job->result;
+}
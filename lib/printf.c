@@ -37,6 +37,7 @@
 #include "interpreter.h"
 #include "io.h"
 #include "printf.h"
+#include "std.h"
 
 // define this globally (e.g. gcc -DPRINTF_INCLUDE_CONFIG_H ...) to include the
 // printf_config.h header file
@@ -52,6 +53,13 @@
 #define PRINTF_NTOA_BUFFER_SIZE 32U
 #endif
 
+// printf() assembles its output in a buffer on the calling thread's stack and
+// hands it to the output device this many bytes at a time
+// default: 64 byte
+#ifndef PRINTF_LINE_BUFFER_SIZE
+#define PRINTF_LINE_BUFFER_SIZE 64U
+#endif
+
 // 'ftoa' conversion buffer size, this must be big enough to hold one converted
 // float number including padded zeros (dynamically created on stack)
 // default: 32 byte
@@ -144,14 +152,32 @@ static inline void _out_null(char character, void* buffer, size_t idx,
     (void)maxlen;
 }
 
-// internal putchar wrapper
-static inline void _out_char(char character, void* buffer, size_t idx,
-                             size_t maxlen) {
-    (void)buffer;
+// line buffer that printf() output goes through on its way to the device
+typedef struct {
+    size_t len;
+    char buf[PRINTF_LINE_BUFFER_SIZE];
+} line_buffer_type;
+
+static void _line_flush(line_buffer_type* line) {
+    if (line->len) {
+        OS_RedirectWrite(line->buf, line->len);
+        line->len = 0U;
+    }
+}
+
+// internal line buffer output, the terminating \0 flushes it
+static void _out_line(char character, void* buffer, size_t idx,
+                      size_t maxlen) {
     (void)idx;
     (void)maxlen;
-    if (character) {
-        putchar(character);
+    line_buffer_type* line = (line_buffer_type*)buffer;
+    if (!character) {
+        _line_flush(line);
+        return;
+    }
+    line->buf[line->len++] = character;
+    if (line->len == PRINTF_LINE_BUFFER_SIZE) {
+        _line_flush(line);
     }
 }
 
@@ -167,6 +193,35 @@ static inline void _out_fct(char character, void* buffer, size_t idx,
     }
 }
 
+// output a run of literal characters from the format string, in bulk when the
+// output function is one that can take it
+static size_t _out_run(out_fct_type out, char* buffer, size_t idx,
+                       size_t maxlen, const char* run, size_t len) {
+    if (out == _out_line) {
+        line_buffer_type* line = (line_buffer_type*)buffer;
+        for (size_t left = len; left;) {
+            size_t chunk = PRINTF_LINE_BUFFER_SIZE - line->len;
+            chunk = left < chunk ? left : chunk;
+            memcpy(&line->buf[line->len], run, chunk);
+            line->len += chunk;
+            run += chunk;
+            left -= chunk;
+            if (line->len == PRINTF_LINE_BUFFER_SIZE) {
+                _line_flush(line);
+            }
+        }
+    } else if (out == _out_buffer) {
+        if (idx < maxlen) {
+            memcpy(&buffer[idx], run, len < maxlen - idx ? len : maxlen - idx);
+        }
+    } else {
+        for (size_t i = 0U; i < len; i++) {
+            out(run[i], buffer, idx + i, maxlen);
+        }
+    }
+    return idx + len;
+}
+
 // internal secure strlen
 // \return The length of the string (excluding the terminating 0) limited by
 // 'maxsize'
@@ -602,9 +657,10 @@ static int _vsnprintf(out_fct_type out, char* buffer, const size_t maxlen,
     while (*format) {
         // format specifier?  %[flags][width][.precision][length]
         if (*format != '%') {
-            // no
-            out(*format, buffer, idx++, maxlen);
-            format++;
+            // no, output everything up to the next one at once
+            const char* run = format;
+            while (*format && *format != '%') { format++; }
+            idx = _out_run(out, buffer, idx, maxlen, run, format - run);
             continue;
         } else {
             // yes, evaluate it
@@ -908,8 +964,8 @@ static int _vsnprintf(out_fct_type out, char* buffer, const size_t maxlen,
 int printf_(const char* format, ...) {
     va_list va;
     va_start(va, format);
-    char buffer[1];
-    const int ret = _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+    line_buffer_type line = {0U};
+    const int ret = _vsnprintf(_out_line, (char*)&line, (size_t)-1, format, va);
     va_end(va);
     return ret;
 }
@@ -931,8 +987,8 @@ int snprintf_(char* buffer, size_t count, const char* format, ...) {
 }
 
 int vprintf_(const char* format, va_list va) {
-    char buffer[1];
-    return _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+    line_buffer_type line = {0U};
+    return _vsnprintf(_out_line, (char*)&line, (size_t)-1, format, va);
 }
 
 int vsnprintf_(char* buffer, size_t count, const char* format, va_list va) {
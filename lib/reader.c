@@ -0,0 +1,123 @@
+#include "reader.h"
+#include "heap.h"
+#include "littlefs.h"
+#include "std.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+bool reader_init(Reader* r, LittleFile* file) {
+    r->file = file;
+    r->buf = malloc(LITTLEFS_BLOCK_SIZE);
+    r->start = r->end = 0;
+    r->error = false;
+    return r->buf;
+}
+
+void reader_free(Reader* r) {
+    if (r->buf) {
+        free(r->buf);
+    }
+    r->buf = 0;
+    r->start = r->end = 0;
+}
+
+void reader_reset(Reader* r) {
+    r->start = r->end = 0;
+    r->error = false;
+}
+
+static int32_t file_read(Reader* r, void* buf, uint32_t len) {
+    int32_t n = r->file ? littlefs_file_read(r->file, buf, len)
+                        : littlefs_read_buffer(buf, len);
+    if (n < 0) {
+        r->error = true;
+    }
+    return n;
+}
+
+// make sure something is buffered, false at the end of the file or on error
+static bool fill(Reader* r) {
+    if (r->start < r->end) {
+        return true;
+    }
+    int32_t n = file_read(r, r->buf, LITTLEFS_BLOCK_SIZE);
+    r->start = 0;
+    r->end = n > 0 ? n : 0;
+    return n > 0;
+}
+
+int32_t reader_read(Reader* r, void* buf, uint32_t len) {
+    uint8_t* out = buf;
+    uint32_t total = 0;
+    while (total < len) {
+        if (r->start == r->end && len - total >= LITTLEFS_BLOCK_SIZE) {
+            // whole blocks can skip the buffer
+            int32_t n = file_read(r, out + total,
+                                  (len - total) & ~(LITTLEFS_BLOCK_SIZE - 1));
+            if (n <= 0) {
+                break;
+            }
+            total += n;
+            continue;
+        }
+        if (!fill(r)) {
+            break;
+        }
+        uint32_t n = min(r->end - r->start, len - total);
+        memcpy(out + total, r->buf + r->start, n);
+        r->start += n;
+        total += n;
+    }
+    return r->error ? -1 : (int32_t)total;
+}
+
+int32_t reader_next(Reader* r, char delim, const uint8_t** out) {
+    if (!fill(r)) {
+        return r->error ? -1 : 0;
+    }
+    const uint8_t* start = r->buf + r->start;
+    uint16_t n = r->end - r->start;
+    const uint8_t* found = memchr(start, delim, n);
+    if (found) {
+        n = found - start + 1;
+    }
+    *out = start;
+    r->start += n;
+    return n;
+}
+
+int32_t reader_read_until(Reader* r, char delim, char* str, uint32_t len) {
+    uint32_t total = 0;
+    while (total + 1 < len && fill(r)) {
+        const uint8_t* start = r->buf + r->start;
+        uint32_t n = min(r->end - r->start, len - 1 - total);
+        const uint8_t* found = memchr(start, delim, n);
+        if (found) {
+            n = found - start + 1;
+        }
+        memcpy(str + total, start, n);
+        r->start += n;
+        total += n;
+        if (found) {
+            break;
+        }
+    }
+    if (len) {
+        str[total] = '\0';
+    }
+    return r->error ? -1 : (int32_t)total;
+}
+
+int32_t reader_getline(Reader* r, char* str, uint32_t len) {
+    int32_t n = reader_read_until(r, '\n', str, len);
+    if (n <= 0) {
+        return -1;
+    }
+    if (str[n - 1] == '\n') {
+        str[--n] = '\0';
+        if (n && str[n - 1] == '\r') {
+            str[--n] = '\0';
+        }
+    }
+    return n;
+}
@@ -0,0 +1,108 @@
+#include "sha256.h"
+#include "std.h"
+#include <stdint.h>
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror(uint32_t x, uint8_t n) {
+    return x >> n | x << (32 - n);
+}
+
+static uint32_t load_be(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void store_be(uint8_t* p, uint32_t n) {
+    p[0] = n >> 24;
+    p[1] = n >> 16;
+    p[2] = n >> 8;
+    p[3] = n;
+}
+
+static void compress(uint32_t* state, const uint8_t* block) {
+    uint32_t w[64];
+    for (uint8_t i = 0; i < 16; i++) { w[i] = load_be(block + 4 * i); }
+    for (uint8_t i = 16; i < 64; i++) {
+        uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ w[i - 15] >> 3;
+        uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ w[i - 2] >> 10;
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (uint8_t i = 0; i < 64; i++) {
+        uint32_t s1 = ror(e, 6) ^ ror(e, 11) ^ ror(e, 25);
+        uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        uint32_t s0 = ror(a, 2) ^ ror(a, 13) ^ ror(a, 22);
+        uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void sha256_init(Sha256* ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->count = 0;
+}
+
+void sha256_update(Sha256* ctx, const void* data, uint32_t len) {
+    const uint8_t* in = data;
+    uint8_t used = ctx->count % 64;
+    ctx->count += len;
+    if (used) { // top up the partial block first
+        uint8_t n = min(64 - used, len);
+        memcpy(ctx->block + used, in, n);
+        in += n;
+        len -= n;
+        if (used + n < 64) {
+            return;
+        }
+        compress(ctx->state, ctx->block);
+    }
+    for (; len >= 64; in += 64, len -= 64) { compress(ctx->state, in); }
+    memcpy(ctx->block, in, len);
+}
+
+void sha256_final(Sha256* ctx, uint8_t* digest) {
+    uint8_t used = ctx->count % 64;
+    ctx->block[used++] = 0x80;
+    if (used > 56) { // no room for the length
+        memset(ctx->block + used, 0, 64 - used);
+        compress(ctx->state, ctx->block);
+        used = 0;
+    }
+    memset(ctx->block + used, 0, 56 - used);
+    store_be(ctx->block + 56, ctx->count >> 29); // length in bits
+    store_be(ctx->block + 60, ctx->count << 3);
+    compress(ctx->state, ctx->block);
+    for (uint8_t i = 0; i < 8; i++) { store_be(digest + 4 * i, ctx->state[i]); }
+}
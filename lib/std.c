@@ -2,34 +2,49 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-uint32_t difference(uint32_t a, uint32_t b) {
-    return a < b ? b - a : a - b;
+// The mem* and str* functions work a word (or a 4 word LDM/STM burst) at a
+// time once the pointers are aligned. They're marked no_builtin so the
+// compiler can't turn their own loops back into calls to themselves.
+#ifdef __clang__
+#define NO_BUILTIN __attribute__((no_builtin))
+#else
+#define NO_BUILTIN
+#endif
+
+#define ONES 0x01010101
+#define HIGHS 0x80808080
+// nonzero if any byte of the word is 0
+#define HAS_ZERO(w) (((w)-ONES) & ~(w)&HIGHS)
+
+static inline bool aligned(const void* p) {
+    return !((uintptr_t)p & 3);
 }
 
-int32_t abs(int32_t n) {
-    return n < 0 ? -n : n;
+uint32_t difference(uint32_t a, uint32_t b) {
+    return a < b ? b - a : a - b;
 }
 
-float sin(float x) {
-    while (x > PI) { x -= 2 * PI; }
-    while (x < -PI) { x += 2 * PI; }
-    // Taylor series
-    float x3 = x * x * x;
-    float x5 = x3 * x * x;
-    float x7 = x3 * x * x;
-    float x9 = x3 * x * x;
-    return x - x3 / 6 + x5 / 120 - x7 / 5040 + x9 / 362880;
+// shift and subtract a bit at a time, since a 64 bit / would need
+// __aeabi_uldivmod from libgcc, which isn't linked
+uint32_t udiv64(uint64_t n, uint32_t d) {
+    uint32_t hi = n >> 32;
+    uint32_t lo = n;
+    uint32_t q = 0;
+    for (uint8_t i = 0; i < 32; i++) {
+        bool carry = hi >> 31;
+        hi = hi << 1 | lo >> 31;
+        lo <<= 1;
+        q <<= 1;
+        if (carry || hi >= d) {
+            hi -= d;
+            q |= 1;
+        }
+    }
+    return q;
 }
 
-float cos(float x) {
-    while (x > PI) { x -= 2 * PI; }
-    while (x < -PI) { x += 2 * PI; }
-    // Taylor series
-    float x2 = x * x;
-    float x4 = x2 * x * x;
-    float x6 = x4 * x * x;
-    float x8 = x6 * x * x;
-    return 1 - x2 / 2 + x4 / 24 - x6 / 720 + x8 / 40320;
+int32_t abs(int32_t n) {
+    return n < 0 ? -n : n;
 }
 
 int32_t min(int32_t a, int32_t b) {
@@ -80,29 +95,107 @@ char* strstr(char* str1, const char* str2) {
     return ((char*)0);
 }
 
-void memset(void* dest, uint8_t value, uint32_t n) {
+NO_BUILTIN void memset(void* dest, uint8_t value, uint32_t n) {
     uint8_t* temp = (uint8_t*)dest;
+    while (n && !aligned(temp)) {
+        *temp++ = value;
+        n--;
+    }
+    uint32_t* wide = (uint32_t*)temp;
+    uint32_t fill = value * ONES;
+    uint32_t bursts = n / 16;
+    if (bursts) {
+#ifdef __arm__
+        __asm volatile("mov r3, %[fill]\n\t"
+                       "mov r4, %[fill]\n\t"
+                       "mov r5, %[fill]\n\t"
+                       "mov r6, %[fill]\n"
+                       "1:\n\t"
+                       "stmia %[dest]!, {r3-r6}\n\t"
+                       "subs %[bursts], %[bursts], #1\n\t"
+                       "bne 1b"
+                       : [dest] "+r"(wide), [bursts] "+r"(bursts)
+                       : [fill] "r"(fill)
+                       : "r3", "r4", "r5", "r6", "cc", "memory");
+#else // the host build in test/ does the same 16 bytes at a time in C
+        for (; bursts; bursts--, wide += 4) {
+            wide[0] = wide[1] = wide[2] = wide[3] = fill;
+        }
+#endif
+    }
+    for (n &= 15; n >= 4; n -= 4) { *wide++ = fill; }
+    temp = (uint8_t*)wide;
     while (n--) { *temp++ = value; }
 }
 
-int32_t memcmp(const void* s1, const void* s2, uint32_t n) {
-    uint8_t* a = (uint8_t*)s1;
-    uint8_t* b = (uint8_t*)s2;
+NO_BUILTIN int32_t memcmp(const void* s1, const void* s2, uint32_t n) {
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+    if (((uintptr_t)a & 3) == ((uintptr_t)b & 3)) {
+        while (n && !aligned(a) && *a == *b) {
+            a++;
+            b++;
+            n--;
+        }
+        if (aligned(a)) {
+            // skip the equal words, the bytes below sort out the first
+            // difference
+            while (n >= 4 && *(const uint32_t*)a == *(const uint32_t*)b) {
+                a += 4;
+                b += 4;
+                n -= 4;
+            }
+        }
+    }
+    for (; n; n--, a++, b++) {
+        if (*a != *b) {
+            return *a < *b ? -1 : 1;
+        }
+    }
+    return 0;
+}
 
-    for (uint32_t i = 0; i < n; i++) {
-        if (a[i] < b[i]) {
-            return -1;
-        } else if (a[i] > b[i]) {
-            return 1;
+NO_BUILTIN void* memchr(const void* s, int32_t c, uint32_t n) {
+    const uint8_t* p = (const uint8_t*)s;
+    uint8_t target = c;
+    while (n && !aligned(p)) {
+        if (*p == target) {
+            return (void*)p;
+        }
+        p++;
+        n--;
+    }
+    // skip the words without it, the bytes below find where it is
+    uint32_t pattern = target * ONES;
+    const uint32_t* wide = (const uint32_t*)p;
+    while (n >= 4 && !HAS_ZERO(*wide ^ pattern)) {
+        wide++;
+        n -= 4;
+    }
+    for (p = (const uint8_t*)wide; n; n--, p++) {
+        if (*p == target) {
+            return (void*)p;
         }
     }
     return 0;
 }
 
-uint16_t strlen(const char* s) {
-    uint16_t n = 0;
-    while (*s++) { n++; }
-    return n;
+// Reading the rest of an aligned word past the terminator is safe since it
+// can't cross into another page or MPU region
+
+NO_BUILTIN uint16_t strlen(const char* s) {
+    const char* start = s;
+    while (!aligned(s)) {
+        if (!*s) {
+            return s - start;
+        }
+        s++;
+    }
+    const uint32_t* wide = (const uint32_t*)s;
+    while (!HAS_ZERO(*wide)) { wide++; }
+    s = (const char*)wide;
+    while (*s) { s++; }
+    return s - start;
 }
 
 char* strcpy(char* dest, const char* src) {
@@ -111,12 +204,27 @@ char* strcpy(char* dest, const char* src) {
     return dest;
 }
 
-char* strchr(const char* str, int32_t c) {
-    int16_t ret = find(str, c);
-    if (ret > -1) {
-        return (char*)(str + ret);
+NO_BUILTIN char* strchr(const char* str, int32_t c) {
+    char target = c;
+    while (!aligned(str)) {
+        if (*str == target) {
+            return (char*)str;
+        }
+        if (!*str) {
+            return 0;
+        }
+        str++;
     }
-    return 0;
+    // stop at the first word with either the target or the terminator in it
+    uint32_t pattern = (uint8_t)target * ONES;
+    const uint32_t* wide = (const uint32_t*)str;
+    while (!HAS_ZERO(*wide) && !HAS_ZERO(*wide ^ pattern)) { wide++; }
+    for (str = (const char*)wide; *str != target; str++) {
+        if (!*str) {
+            return 0;
+        }
+    }
+    return (char*)str;
 }
 
 size_t strspn(const char* str1, const char* str2) {
@@ -226,38 +334,58 @@ char* itoa(int32_t value, char* s, uint8_t radix) {
     return reverse(s);
 }
 
-void memcpy(void* dest, const void* src, uint32_t n) {
-    uint32_t* wide_a = dest;
-    const uint32_t* wide_b = src;
-    if (!((uint32_t)src % 4 || (uint32_t)dest % 4)) {
-        while (n >= 4) {
-            *wide_a++ = *wide_b++;
-            n -= 4;
+NO_BUILTIN void memcpy(void* dest, const void* src, uint32_t n) {
+    uint8_t* a = dest;
+    const uint8_t* b = src;
+    while (n && !aligned(a)) {
+        *a++ = *b++;
+        n--;
+    }
+    uint32_t* wide_a = (uint32_t*)a;
+    if (aligned(b)) {
+        uint32_t bursts = n / 16;
+        if (bursts) {
+#ifdef __arm__
+            __asm volatile("1:\n\t"
+                           "ldmia %[src]!, {r3-r6}\n\t"
+                           "stmia %[dest]!, {r3-r6}\n\t"
+                           "subs %[bursts], %[bursts], #1\n\t"
+                           "bne 1b"
+                           : [dest] "+r"(wide_a), [src] "+r"(b),
+                             [bursts] "+r"(bursts)
+                           :
+                           : "r3", "r4", "r5", "r6", "cc", "memory");
+#else
+            for (; bursts; bursts--, wide_a += 4, b += 16) {
+                const uint32_t* wide_b = (const uint32_t*)b;
+                wide_a[0] = wide_b[0];
+                wide_a[1] = wide_b[1];
+                wide_a[2] = wide_b[2];
+                wide_a[3] = wide_b[3];
+            }
+#endif
+            n &= 15;
         }
     }
-    uint8_t* a = (uint8_t*)wide_a;
-    const uint8_t* b = (const uint8_t*)wide_b;
+    // the M4 can do unaligned single word loads, so a misaligned source
+    // still goes a word at a time
+    for (; n >= 4; n -= 4, b += 4) {
+        *wide_a++ = ((const struct __attribute__((packed)) {
+                        uint32_t word;
+                    }*)b)->word;
+    }
+    a = (uint8_t*)wide_a;
     while (n--) { *a++ = *b++; }
 }
 
 // Compiler generated intrinsics
 
 void __aeabi_memclr4(void* mem, size_t bytes) {
-    uint32_t* buf = (uint32_t*)mem;
-    while (bytes > 0) {
-        *buf = 0;
-        ++buf;
-        bytes -= 4;
-    }
+    memset(mem, 0, bytes);
 }
 
 void __aeabi_memcpy4(void* dest, const void* src, uint32_t n) {
-    uint32_t* a = dest;
-    const uint32_t* b = src;
-    while (n > 0) {
-        *a++ = *b++;
-        n -= 4;
-    }
+    memcpy(dest, src, n);
 }
 
 __attribute__((alias("memcpy"))) void
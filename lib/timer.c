@@ -2,18 +2,23 @@
 #include "timer.h"
 #include "tivaware/hw_memmap.h"
 #include "tivaware/rom.h"
+#include "trace.h"
 
 static void (*tasks[12])(void);
 
 #define TIMERHANDLER(n)                                                        \
     void timer##n##a_handler(void) {                                           \
+        TRACE_ISR_ENTER();                                                     \
         ROM_TimerIntClear(TIMER##n##_BASE, TIMER_A);                           \
         (*tasks[n])();                                                         \
+        TRACE_ISR_EXIT();                                                      \
     }
 #define WTIMERHANDLER(n)                                                       \
     void wtimer##n##a_handler(void) {                                          \
+        TRACE_ISR_ENTER();                                                     \
         ROM_TimerIntClear(WTIMER##n##_BASE, TIMER_A);                          \
         (*tasks[n + 6])();                                                     \
+        TRACE_ISR_EXIT();                                                      \
     }
 
 TIMERHANDLER(0)
@@ -81,6 +86,17 @@ void timer_enable(uint8_t timer_num, uint32_t period, void (*task)(void),
     ROM_TimerEnable(config.base, TIMER_BOTH);
 }
 
+void timer_restart(uint8_t timer_num, uint32_t period) {
+    uint32_t base = timers[timer_num].base;
+    ROM_TimerDisable(base, TIMER_BOTH);
+    ROM_TimerLoadSet(base, TIMER_A, period);
+    ROM_TimerEnable(base, TIMER_BOTH);
+}
+
+void timer_stop(uint8_t timer_num) {
+    ROM_TimerDisable(timers[timer_num].base, TIMER_BOTH);
+}
+
 void busy_wait(uint8_t timer_num, uint32_t duration) {
     TimerConfig config = timers[timer_num];
     ROM_SysCtlPeripheralEnable(config.sysctl_periph);
@@ -0,0 +1,112 @@
+#include "trace.h"
+#include "interrupts.h"
+#include "io.h"
+#include "littlefs.h"
+#include "printf.h"
+#include "std.h"
+#include "tivaware/hw_memmap.h"
+#include "tivaware/hw_timer.h"
+#include "tivaware/hw_types.h"
+#include <stdint.h>
+
+#ifdef TRACE_KERNEL
+
+#define TRACE_NAMES 16
+
+typedef struct {
+    uint32_t time;
+    uint32_t type;
+    uint32_t a;
+    uint32_t b;
+} TraceEvent;
+
+extern bool os_running; // the OS timer isn't clocked until OS_Launch
+
+static TraceEvent trace_buffer[TRACE_EVENTS];
+static uint32_t trace_idx; // total events recorded since the last clear
+static bool trace_paused;
+
+// names of the most recently added threads, since their TRACE_THREAD events
+// are likely to have been overwritten by the time the buffer is dumped
+static struct {
+    uint32_t id;
+    const char* name;
+} trace_names[TRACE_NAMES] = {{0, "OS Idle"}};
+static uint8_t trace_name_idx = 1;
+
+void trace_event(TraceType type, uint32_t a, uint32_t b) {
+    if (trace_paused) {
+        return;
+    }
+    uint32_t idx = __atomic_fetch_add(&trace_idx, 1, __ATOMIC_RELAXED);
+    TraceEvent* event = &trace_buffer[idx & (TRACE_EVENTS - 1)];
+    event->time = os_running ? HWREG(WTIMER5_BASE + TIMER_O_TAR) : 0;
+    event->type = type;
+    event->a = a;
+    event->b = b;
+    if (type == TRACE_THREAD) {
+        uint32_t crit = start_critical();
+        trace_names[trace_name_idx].id = a;
+        trace_names[trace_name_idx].name = (const char*)b;
+        trace_name_idx = (trace_name_idx + 1) % TRACE_NAMES;
+        if (!trace_name_idx) {
+            trace_name_idx = 1; // keep the idle thread
+        }
+        end_critical(crit);
+    }
+}
+
+// call out with each line of the dump
+static void trace_lines(void (*out)(const char* line, void* arg), void* arg) {
+    char line[48];
+    trace_paused = true;
+    uint32_t end = trace_idx;
+    uint32_t start = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+    for (uint32_t i = start; i < end; ++i) {
+        TraceEvent* event = &trace_buffer[i & (TRACE_EVENTS - 1)];
+        snprintf(line, sizeof(line), "@K %08x %x %08x %08x\n\r", event->time,
+                 event->type, event->a, event->b);
+        out(line, arg);
+    }
+    for (uint8_t i = 0; i < TRACE_NAMES; ++i) {
+        if (trace_names[i].name) {
+            snprintf(line, sizeof(line), "@N %x %s\n\r", trace_names[i].id,
+                     trace_names[i].name);
+            out(line, arg);
+        }
+    }
+    trace_paused = false;
+}
+
+static void print_line(const char* line, void* arg) {
+    printf("%s", line);
+}
+
+void trace_dump(void) {
+    trace_lines(print_line, 0);
+}
+
+static void write_line(const char* line, void* ok) {
+    uint32_t len = strlen(line);
+    if (littlefs_write_buffer((void*)line, len) != len) {
+        *(bool*)ok = false;
+    }
+}
+
+bool trace_save(const char* name) {
+    littlefs_remove(name); // opening doesn't truncate
+    if (!littlefs_open_file(name, true)) {
+        return false;
+    }
+    bool ok = true;
+    trace_lines(write_line, &ok);
+    return littlefs_close_file() && ok;
+}
+
+void trace_clear(void) {
+    uint32_t crit = start_critical();
+    trace_idx = 0;
+    end_critical(crit);
+}
+
+#endif
@@ -0,0 +1,304 @@
+#include "transfer.h"
+#include "OS.h"
+#include "esp8266.h"
+#include "heap.h"
+#include "io.h"
+#include "lfs_util.h"
+#include "littlefs.h"
+#include "printf.h"
+#include "timer.h"
+#include <stdint.h>
+
+#define FRAME_SOF 0x7e
+#define FRAME_DATA 'D'
+#define FRAME_END 'E'
+#define FRAME_HEADER 6 // sof, type, seq, length
+#define FRAME_MAX (FRAME_HEADER + TRANSFER_PAYLOAD + 4)
+
+#define DEFAULT_BAUD 115200
+#define DEFAULT_RX_BUFFER 128 // what io.c starts with
+// room for the rest of the window while a frame is being written
+#define RX_BUFFER 2048
+#define BYTE_TIMEOUT_MS 100    // a gap this long inside a frame means it's cut
+#define QUIET_MS 20            // the sender has stopped after a bad frame
+#define IDLE_TIMEOUT_MS 10000  // the sender has gone away
+#define ANSWER_TIMEOUT_MS 2000 // send the window again if nothing comes back
+#define RETRIES 10
+
+typedef enum { FRAME_OK, FRAME_BAD, FRAME_TIMEOUT } FrameResult;
+
+static uint16_t get16(const uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return get16(p) | get16(p + 2) << 16;
+}
+
+static void put16(uint8_t* p, uint16_t n) {
+    p[0] = n;
+    p[1] = n >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t n) {
+    put16(p, n);
+    put16(p + 2, n >> 16);
+}
+
+// read len bytes, waiting at most timeout cycles for each piece
+static uint32_t chan_read(bool remote, void* buf, uint32_t len,
+                          uint32_t timeout) {
+    if (!remote) {
+        return uart_read(buf, len, timeout);
+    }
+    uint8_t* out = buf;
+    uint32_t n = 0;
+    while (n < len) {
+        int32_t got = esp_socket_recv(OS_Link(), out + n, len - n, timeout);
+        if (got <= 0) {
+            break;
+        }
+        n += got;
+    }
+    return n;
+}
+
+static void chan_write(bool remote, const void* buf, uint32_t len) {
+    if (remote) {
+        ESP8266_Write(buf, len);
+        ESP8266_Flush();
+    } else {
+        uart_write(buf, len);
+    }
+}
+
+// CRC-32 of a frame, lfs_crc leaves out the final inversion
+static uint32_t frame_crc(const uint8_t* frame, uint16_t len) {
+    return lfs_crc(0xffffffff, frame + 1, FRAME_HEADER - 1 + len) ^ 0xffffffff;
+}
+
+// wait for the start of a frame, then read the rest of it
+static FrameResult read_frame(uint8_t* frame) {
+    do {
+        if (!uart_read(frame, 1, ms(IDLE_TIMEOUT_MS))) {
+            return FRAME_TIMEOUT;
+        }
+    } while (frame[0] != FRAME_SOF);
+    uint32_t timeout = ms(BYTE_TIMEOUT_MS);
+    if (uart_read(frame + 1, FRAME_HEADER - 1, timeout) != FRAME_HEADER - 1) {
+        return FRAME_BAD;
+    }
+    uint16_t len = get16(frame + 4);
+    if (len > TRANSFER_PAYLOAD ||
+        uart_read(frame + FRAME_HEADER, len + 4, timeout) != len + 4u) {
+        return FRAME_BAD;
+    }
+    return frame_crc(frame, len) == get32(frame + FRAME_HEADER + len)
+               ? FRAME_OK
+               : FRAME_BAD;
+}
+
+static void reply(char kind, uint16_t seq) {
+    char msg[3] = {kind, seq & 0xff, seq >> 8};
+    uart_write(msg, sizeof(msg));
+}
+
+// throw out the rest of what the sender had in flight
+static void drain(void) {
+    uint8_t c;
+    while (uart_read(&c, 1, ms(QUIET_MS))) {}
+}
+
+// returns the file size or -1
+static int32_t receive_frames(uint8_t* frame) {
+    uint16_t expected = 0;
+    uint32_t size = 0;
+    uint32_t crc = 0xffffffff;
+    while (true) {
+        FrameResult got = read_frame(frame);
+        if (got == FRAME_TIMEOUT) {
+            return -1;
+        }
+        uint16_t seq = get16(frame + 2);
+        if (got == FRAME_BAD || seq > expected) { // go back to what's missing
+            drain();
+            reply('N', expected);
+            continue;
+        } else if (seq < expected) { // our answer got lost
+            reply('A', expected);
+            continue;
+        }
+        uint16_t len = get16(frame + 4);
+        uint8_t* payload = frame + FRAME_HEADER;
+        if (frame[1] == FRAME_DATA) {
+            if (littlefs_write_buffer(payload, len) != len) {
+                reply('X', expected);
+                return -1;
+            }
+            crc = lfs_crc(crc, payload, len);
+            size += len;
+            reply('A', ++expected);
+        } else if (frame[1] == FRAME_END && len == 8) {
+            bool ok = get32(payload) == size &&
+                      get32(payload + 4) == (crc ^ 0xffffffff);
+            reply(ok ? 'A' : 'X', expected + 1);
+            return ok ? size : -1;
+        } else {
+            reply('X', expected);
+            return -1;
+        }
+    }
+}
+
+int32_t transfer_receive(const char* name, uint32_t baud) {
+    // received under a temporary name and renamed over name once the end
+    // frame checks out, so a failed upload leaves an existing file alone
+    char temp[LITTLEFS_NAME_MAX + 2];
+    if (snprintf(temp, sizeof(temp), "%s~", name) > LITTLEFS_NAME_MAX) {
+        return -1;
+    }
+    uint8_t* frame = malloc(FRAME_MAX);
+    if (!frame) {
+        return -1;
+    }
+    littlefs_remove(temp); // opening doesn't truncate
+    if (!littlefs_open_file(temp, true)) {
+        free(frame);
+        return -1;
+    }
+    int32_t size = -1;
+    if (uart_rx_size(RX_BUFFER)) {
+        uart_puts("@U ready");
+        if (baud) {
+            uart_change_speed(baud);
+        }
+        size = receive_frames(frame);
+        if (baud) {
+            uart_change_speed(DEFAULT_BAUD);
+        }
+        uart_rx_size(DEFAULT_RX_BUFFER);
+    }
+    free(frame);
+    if (!littlefs_close_file() || size < 0 || !littlefs_move(temp, name)) {
+        littlefs_remove(temp);
+        return -1;
+    }
+    return size;
+}
+
+// CRC-32 (without the final inversion) of the first n bytes of the open file,
+// read through buffer
+// returns false if the file can't be read
+static bool prefix_crc(uint8_t* buffer, uint32_t n, uint32_t* crc) {
+    *crc = 0xffffffff;
+    if (!littlefs_seek(0)) {
+        return false;
+    }
+    for (uint32_t done = 0; done < n;) {
+        uint16_t len = min(TRANSFER_PAYLOAD, n - done);
+        if (littlefs_read_buffer(buffer, len) != len) {
+            return false;
+        }
+        *crc = lfs_crc(*crc, buffer, len);
+        done += len;
+    }
+    return true;
+}
+
+// fill in the frame for seq, reading its part of the file unless it's the end
+// returns the frame's total length, or 0 if the file can't be read
+static uint16_t build_frame(uint8_t* frame, uint16_t seq, uint16_t frames,
+                            uint32_t offset, uint32_t size, uint32_t crc) {
+    uint16_t len;
+    frame[0] = FRAME_SOF;
+    if (seq == frames - 1) {
+        frame[1] = FRAME_END;
+        len = 8;
+        put32(frame + FRAME_HEADER, size);
+        put32(frame + FRAME_HEADER + 4, crc ^ 0xffffffff);
+    } else {
+        uint32_t start = offset + seq * TRANSFER_PAYLOAD;
+        len = min(TRANSFER_PAYLOAD, size - start);
+        frame[1] = FRAME_DATA;
+        if (!littlefs_seek(start) ||
+            littlefs_read_buffer(frame + FRAME_HEADER, len) != len) {
+            return 0;
+        }
+    }
+    put16(frame + 2, seq);
+    put16(frame + 4, len);
+    put32(frame + FRAME_HEADER + len, frame_crc(frame, len));
+    return FRAME_HEADER + len + 4;
+}
+
+// crc starts as the CRC of the bytes before offset, so the end frame covers
+// the whole file
+// returns false if the file couldn't be read or the receiver gave up
+static bool send_frames(uint8_t* frame, uint32_t offset, uint32_t size,
+                        uint32_t crc, bool remote) {
+    uint16_t frames =
+        (size - offset + TRANSFER_PAYLOAD - 1) / TRANSFER_PAYLOAD + 1;
+    uint16_t base = 0;    // oldest frame not acknowledged
+    uint16_t sending = 0; // next frame to send
+    uint16_t crc_seq = 0; // the CRC covers the frames before this
+    uint8_t retries = 0;
+    while (base < frames) {
+        while (sending < frames && sending < base + TRANSFER_WINDOW) {
+            uint16_t len =
+                build_frame(frame, sending, frames, offset, size, crc);
+            if (!len) {
+                return false;
+            }
+            if (sending == crc_seq && frame[1] == FRAME_DATA) {
+                crc = lfs_crc(crc, frame + FRAME_HEADER, get16(frame + 4));
+                crc_seq++;
+            }
+            chan_write(remote, frame, len);
+            sending++;
+        }
+        uint8_t answer[3];
+        if (chan_read(remote, answer, 3, ms(ANSWER_TIMEOUT_MS)) < 3) {
+            if (++retries > RETRIES) {
+                return false;
+            }
+            sending = base;
+            continue;
+        }
+        uint16_t seq = get16(answer + 1);
+        if (answer[0] == 'A') {
+            retries = 0;
+            base = max(base, seq);
+            sending = max(sending, base);
+        } else if (answer[0] == 'N' && seq <= sending) {
+            if (++retries > RETRIES) {
+                return false;
+            }
+            base = sending = max(base, seq);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int32_t transfer_send(const char* name, uint32_t offset, bool remote) {
+    if (!littlefs_open_file(name, false)) {
+        return -1;
+    }
+    int32_t size = littlefs_size();
+    uint8_t* frame = malloc(FRAME_MAX);
+    uint32_t crc;
+    bool ok = frame && size >= 0 && offset <= (uint32_t)size &&
+              prefix_crc(frame, offset, &crc);
+    if (ok) {
+        char ready[24];
+        snprintf(ready, sizeof(ready), "@D ready %d\n\r", size);
+        chan_write(remote, ready, strlen(ready));
+        ok = send_frames(frame, offset, size, crc, remote);
+    }
+    if (frame) {
+        free(frame);
+    }
+    littlefs_close_file();
+    return ok ? size - offset : -1;
+}
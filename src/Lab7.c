@@ -1,10 +1,14 @@
 #include "OS.h"
+#include "fastmath.h"
 #include "interpreter.h"
 #include "mouse.h"
+#include "pool.h"
 #include "printf.h"
 #include "std.h"
 
 void local_interpreter(void) {
+    // a worker for short jobs like the mouse circling
+    pool_init(1, 512, 2, 4);
     interpreter(false);
 }
 
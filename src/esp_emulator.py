@@ -0,0 +1,526 @@
+#!/usr/bin/python
+
+# Stands in for the ESP8266 on the other end of UART2, so the AT command,
+# +IPD and transparent passthrough code in lib/esp8266.c can be run without a
+# module. Links are real TCP connections from this machine. CIPSTART connects
+# out, and CIPSERVER listens on the same port here.
+#
+# The "+++" escape is treated like the module does. It only ends passthrough
+# if the line was quiet for the guard time before it, and again after it.
+# Otherwise the three bytes are sent on as data. That is what
+# ESP8266_StopPassthrough's sleeps are for.
+#
+# usage: esp_emulator.py [--guard SECONDS]
+#          opens a pty and prints its name, bridge it to a USB serial adapter
+#          wired to UART2 with socat, or talk to it by hand
+#        esp_emulator.py --port PORT [--reset-pin] [--guard SECONDS]
+#          answers on a serial port, with --reset-pin a low pulse on DSR
+#          (wired to PB1) restarts it like the module's reset pin does
+#        esp_emulator.py --check
+#          drives the emulator through a pty the way lib/esp8266.c does,
+#          including passthrough and its escape, and checks the answers
+
+import argparse
+import os
+import re
+import select
+import socket
+import sys
+import threading
+import time
+import tty
+
+GUARD = 1.0  # seconds of quiet around "+++"
+LINKS = 5
+BAUD = 115200
+MAC = "18:fe:34:00:00:01"
+
+
+class Pty:
+    def __init__(self):
+        self.fd, self.slave = os.openpty()  # kept open so writes never fail
+        tty.setraw(self.slave)
+        self.name = os.ttyname(self.slave)
+
+    def fileno(self):
+        return self.fd
+
+    def read(self):
+        return os.read(self.fd, 4096)
+
+    def write(self, data):
+        os.write(self.fd, data)
+
+    def baud(self, rate, flow):
+        pass
+
+    def in_reset(self):
+        return False
+
+
+class Port:
+    def __init__(self, name, reset_pin):
+        import serial
+        self.port = serial.Serial(name, BAUD, timeout=0)
+        self.reset_pin = reset_pin
+
+    def fileno(self):
+        return self.port.fileno()
+
+    def read(self):
+        return self.port.read(4096)
+
+    def write(self, data):
+        self.port.write(data)
+
+    def baud(self, rate, flow):
+        self.port.flush()  # the answer goes out at the old rate
+        self.port.baudrate = rate
+        self.port.rtscts = flow
+
+    def in_reset(self):
+        return self.reset_pin and self.port.dsr
+
+
+class Emulator:
+    def __init__(self, line, guard=GUARD):
+        self.line = line
+        self.guard = guard
+        self.links = {}  # link id to socket
+        self.server = None
+        self.reset()
+
+    def reset(self):
+        for link in list(self.links):
+            self.close(link, quiet=True)
+        if self.server:
+            self.server.close()
+            self.server = None
+        self.echo = True
+        self.mux = False
+        self.mode = 0  # CIPMODE
+        self.passthrough = False
+        self.command = bytearray()
+        self.sending = None  # (link, length) while taking CIPSEND data
+        self.data = bytearray()
+        self.held = bytearray()  # "+" bytes that may be the escape
+        self.last_rx = time.monotonic()
+        self.line.baud(BAUD, False)
+
+    def boot(self):
+        time.sleep(0.1)
+        self.line.write(b"\r\n ets Jan  8 2013,rst cause:2, boot mode:(3,6)"
+                        b"\r\n\r\nready\r\n")
+
+    def say(self, *lines):
+        self.line.write(b"".join(text.encode() + b"\r\n" for text in lines))
+
+    def ok(self, *lines):
+        self.say(*lines)
+        self.line.write(b"\r\nOK\r\n")
+
+    def error(self, *lines):
+        self.say(*lines)
+        self.line.write(b"\r\nERROR\r\n")
+
+    def link_name(self, link, event):
+        return "%d,%s" % (link, event) if self.mux else event
+
+    def close(self, link, quiet=False):
+        self.links.pop(link).close()
+        if not quiet:
+            self.say(self.link_name(link, "CLOSED"))
+
+    def run(self):
+        self.boot()
+        while True:
+            timeout = None
+            if self.held:
+                timeout = max(self.last_rx + self.guard - time.monotonic(), 0)
+            if isinstance(self.line, Port) and self.line.reset_pin:
+                timeout = 0.01 if timeout is None else min(timeout, 0.01)
+            sources = [self.line] + list(self.links.values())
+            if self.server:
+                sources.append(self.server)
+            ready = select.select(sources, [], [], timeout)[0]
+            now = time.monotonic()
+            if self.line in ready:
+                self.receive(self.line.read(), now)
+            if self.server in ready:
+                self.accept()
+            for link, sock in list(self.links.items()):
+                if sock in ready:
+                    self.from_link(link, sock)
+            self.tick(now)
+            if self.line.in_reset():
+                while self.line.in_reset():
+                    time.sleep(0.01)
+                self.reset()
+                self.boot()
+
+    # bytes from the board
+
+    def receive(self, data, now):
+        if self.passthrough:
+            self.passthrough_data(data, now)
+        else:
+            for byte in data:
+                self.command_byte(byte)
+        self.last_rx = now
+
+    def passthrough_data(self, data, now):
+        # the escape has to start after a quiet guard time
+        quiet = now - self.last_rx >= self.guard
+        for byte in data:
+            if byte == ord("+") and len(self.held) < 3 and \
+                    (self.held or quiet):
+                self.held.append(byte)
+            else:
+                self.to_link(0, self.held + bytes([byte]))
+                self.held.clear()
+            quiet = False
+
+    def tick(self, now):
+        if not self.held or now - self.last_rx < self.guard:
+            return
+        if len(self.held) == 3:  # and quiet after it too
+            self.passthrough = False  # the module says nothing
+        else:
+            self.to_link(0, self.held)
+        self.held.clear()
+
+    def to_link(self, link, data):
+        if link in self.links:
+            self.links[link].sendall(data)
+
+    def command_byte(self, byte):
+        if self.sending:
+            self.data.append(byte)
+            link, length = self.sending
+            if len(self.data) == length:
+                self.to_link(link, self.data)
+                self.sending = None
+                self.say("", "Recv %d bytes" % length, "", "SEND OK")
+            return
+        if self.echo:
+            self.line.write(bytes([byte]))
+        self.command.append(byte)
+        if byte == ord("\n"):
+            text = self.command.decode(errors="replace").strip()
+            self.command.clear()
+            if text:
+                self.at(text)
+
+    # bytes from the network
+
+    def accept(self):
+        sock = self.server.accept()[0]
+        free = [link for link in range(LINKS) if link not in self.links]
+        if not free:
+            sock.close()
+            return
+        self.links[free[0]] = sock
+        self.say("%d,CONNECT" % free[0])
+
+    def from_link(self, link, sock):
+        try:
+            data = sock.recv(2048)
+        except OSError:
+            data = b""
+        if not data:
+            self.close(link, quiet=self.passthrough)
+        elif self.passthrough:
+            self.line.write(data)
+        elif self.mux:
+            self.line.write(b"\r\n+IPD,%d,%d:" % (link, len(data)) + data)
+        else:
+            self.line.write(b"\r\n+IPD,%d:" % len(data) + data)
+
+    # AT commands
+
+    def at(self, text):
+        name, _, arg = text.partition("=")
+        handler = getattr(self, "at_" + re.sub(r"\W", "_", name.lower()),
+                          None)
+        if not handler:
+            self.error()
+            return
+        try:
+            handler(arg)
+        except (ValueError, IndexError):
+            self.error()
+
+    def at_at(self, arg):
+        self.ok()
+
+    def at_ate0(self, arg):
+        self.echo = False
+        self.ok()
+
+    def at_ate1(self, arg):
+        self.echo = True
+        self.ok()
+
+    def at_at_rst(self, arg):
+        self.ok()
+        self.reset()
+        self.boot()
+
+    at_at_restore = at_at_rst
+
+    def at_at_gmr(self, arg):
+        self.ok("AT version:1.2.0.0(emulated)", "SDK version:2.0.0")
+
+    def at_at_cipstamac_(self, arg):
+        self.ok('+CIPSTAMAC:"%s"' % MAC)
+
+    def at_at_cifsr(self, arg):
+        self.ok('+CIFSR:STAIP,"127.0.0.1"', '+CIFSR:STAMAC,"%s"' % MAC)
+
+    def at_at_cwlap(self, arg):
+        self.ok('+CWLAP:(3,"emulated",-40,"18:fe:34:00:00:02",1)')
+
+    def at_at_cwjap(self, arg):
+        self.ok("WIFI CONNECTED", "WIFI GOT IP")
+
+    def at_at_cwqap(self, arg):
+        self.ok("WIFI DISCONNECT")
+
+    def at_at_cwmode(self, arg):
+        self.ok()
+
+    def at_at_cipsto(self, arg):
+        self.ok()
+
+    def at_at_uart_cur(self, arg):
+        rate, _, _, _, flow = (int(x) for x in arg.split(","))
+        self.ok()
+        self.line.baud(rate, flow == 3)
+
+    def at_at_cipmux(self, arg):
+        if self.links:
+            self.error("link is builded")
+            return
+        self.mux = int(arg) == 1
+        self.ok()
+
+    def at_at_cipmode(self, arg):
+        if self.mux:  # passthrough is only for a single connection
+            self.error()
+            return
+        self.mode = int(arg)
+        self.ok()
+
+    def at_at_cipserver(self, arg):
+        fields = arg.split(",")
+        if not self.mux:
+            self.error()
+        elif int(fields[0]):
+            if not self.server:
+                self.server = socket.create_server(("", int(fields[1])))
+            self.ok()
+        else:
+            if self.server:
+                self.server.close()
+                self.server = None
+            self.ok()
+
+    def at_at_cipstart(self, arg):
+        match = re.fullmatch(r'(?:(\d),)?"TCP","([^"]+)",(\d+)', arg)
+        link = int(match.group(1) or 0) if match else None
+        if link is None or link in self.links or \
+                (match.group(1) is not None) != self.mux:
+            self.error()
+            return
+        try:
+            sock = socket.create_connection(
+                (match.group(2), int(match.group(3))), 5)
+        except OSError:
+            self.error("CLOSED")
+            return
+        sock.settimeout(None)
+        self.links[link] = sock
+        self.ok(self.link_name(link, "CONNECT"))
+
+    def at_at_cipsend(self, arg):
+        if not arg:  # the endless send of passthrough
+            if self.mode != 1 or self.mux or 0 not in self.links:
+                self.error()
+                return
+            self.line.write(b"\r\nOK\r\n\r\n>")
+            self.passthrough = True
+            return
+        fields = [int(x) for x in arg.split(",")]
+        link, length = fields if self.mux else (0, fields[0])
+        if self.mode or link not in self.links or not 0 < length <= 2048:
+            self.error()
+            return
+        self.sending = (link, length)
+        self.data.clear()
+        self.line.write(b"\r\nOK\r\n> ")
+
+    def at_at_cipclose(self, arg):
+        link = int(arg) if arg else 0
+        if link not in self.links:
+            self.error()
+            return
+        self.close(link)
+        self.ok()
+
+    def at_at_cipstatus(self, arg):
+        lines = ["STATUS:%d" % (3 if self.links else 4)]
+        for link, sock in self.links.items():
+            host, port = sock.getpeername()[:2]
+            local = sock.getsockname()[1]
+            served = self.server and self.server.getsockname()[1] == local
+            lines.append('+CIPSTATUS:%d,"TCP","%s",%d,%d,%d' %
+                         (link, host, port, local, bool(served)))
+        self.ok(*lines)
+
+
+# --check, talking to the emulator the way lib/esp8266.c does
+
+
+class Board:
+    def __init__(self, name):
+        self.fd = os.open(name, os.O_RDWR | os.O_NOCTTY)
+        self.buffer = b""
+
+    def write(self, data):
+        os.write(self.fd, data)
+
+    def expect(self, text, timeout=3):
+        end = time.monotonic() + timeout
+        while text.encode() not in self.buffer:
+            left = end - time.monotonic()
+            if left <= 0 or not select.select([self.fd], [], [], left)[0]:
+                raise AssertionError("expected %r, got %r" %
+                                     (text, self.buffer))
+            self.buffer += os.read(self.fd, 4096)
+        self.buffer = self.buffer.split(text.encode(), 1)[1]
+
+    def nothing(self, seconds):
+        if select.select([self.fd], [], [], seconds)[0]:
+            raise AssertionError("unexpected %r" % os.read(self.fd, 4096))
+
+    def command(self, text, answer="\r\nOK\r\n"):
+        self.write(text.encode() + b"\r\n")
+        self.expect(answer)
+
+
+def echo_server():
+    server = socket.create_server(("127.0.0.1", 0))
+
+    def serve():
+        while True:
+            sock = server.accept()[0]
+            threading.Thread(target=echo, args=(sock,), daemon=True).start()
+
+    def echo(sock):
+        while data := sock.recv(4096):
+            sock.sendall(data)
+
+    threading.Thread(target=serve, daemon=True).start()
+    return server.getsockname()[1]
+
+
+def check(guard):
+    emulator = Emulator(Pty(), guard)
+    threading.Thread(target=emulator.run, daemon=True).start()
+    board = Board(emulator.line.name)
+    port = echo_server()
+    steps = []
+
+    def step(name):
+        steps.append(name)
+        print("%-52s" % name, end="", flush=True)
+
+    step("boots saying ready")
+    board.expect("\r\nready\r\n")
+    board.command("ATE0")
+    print("ok")
+
+    step("CIPSEND with +IPD framing")
+    board.command("AT+CIPMUX=0")
+    board.command('AT+CIPSTART="TCP","127.0.0.1",%d' % port)
+    board.command("AT+CIPSEND=5", "> ")
+    board.write(b"hello")
+    board.expect("Recv 5 bytes\r\n\r\nSEND OK\r\n")
+    board.expect("+IPD,5:hello")
+    print("ok")
+
+    step("no passthrough with several connections")
+    board.command("AT+CIPCLOSE")
+    board.command("AT+CIPMUX=1")
+    board.command("AT+CIPMODE=1", "\r\nERROR\r\n")
+    board.command("AT+CIPMUX=0")
+    board.command('AT+CIPSTART="TCP","127.0.0.1",%d' % port)
+    print("ok")
+
+    step("CIPMODE=1 and an endless CIPSEND start passthrough")
+    board.command("AT+CIPMODE=1")
+    board.command("AT+CIPSEND", ">")
+    board.write(b"raw bytes\r\nAT\r\n")
+    board.expect("raw bytes\r\nAT\r\n")
+    board.nothing(0.1)  # no +IPD or OK, it was all data
+    print("ok")
+
+    step("+++ without the guard time before it is data")
+    board.write(b"x")
+    time.sleep(guard / 2)
+    board.write(b"+++")
+    board.expect("x+++")
+    print("ok")
+
+    step("+++ followed by data within the guard time is data")
+    time.sleep(guard * 1.2)
+    board.write(b"+++")
+    time.sleep(guard / 2)
+    board.write(b"y")
+    board.expect("+++y")
+    print("ok")
+
+    step("+++ with the guard time around it ends passthrough")
+    time.sleep(guard * 1.2)
+    board.write(b"+++")
+    board.nothing(guard * 1.2)
+    board.command("AT")
+    board.command("AT+CIPMODE=0")
+    board.command("AT+CIPSEND=3", "> ")
+    board.write(b"abc")
+    board.expect("+IPD,3:abc")
+    print("ok")
+
+    step("a closed link is reported")
+    board.command("AT+CIPCLOSE", "CLOSED\r\n\r\nOK\r\n")
+    print("ok")
+    print("esp emulator ok")
+
+
+parser = argparse.ArgumentParser(description="emulate an ESP8266 on a pty")
+parser.add_argument("--port", help="answer on this serial port instead")
+parser.add_argument("--reset-pin", action="store_true",
+                    help="restart on a low pulse on DSR, wired to PB1")
+parser.add_argument("--guard", type=float, default=GUARD,
+                    help="seconds of quiet around +++ (default %(default)s)")
+parser.add_argument("--check", action="store_true",
+                    help="check the emulator against what lib/esp8266.c does")
+args = parser.parse_args()
+
+if args.check:
+    try:
+        check(args.guard)
+    except AssertionError as e:
+        print("FAIL\n%s" % e)
+        sys.exit(1)
+    sys.exit(0)
+
+if args.port:
+    line = Port(args.port, args.reset_pin)
+else:
+    line = Pty()
+    print("ESP8266 on %s" % line.name)
+try:
+    Emulator(line, args.guard).run()
+except KeyboardInterrupt:
+    pass
@@ -0,0 +1,108 @@
+#!/usr/bin/python
+
+# Decode the binary trace log printed by the `log` command back into text.
+# The format strings are looked up by address in the ELF that's running on the
+# board, so it has to be the exact same build.
+#
+# usage: logdecode.py ELF [CAPTURE]
+#   CAPTURE is a file with the output of `log` (like a screen -L log), or a
+#   serial port to send the command to. Reads stdin if it's left out.
+
+import os
+import re
+import stat
+import sys
+import serial
+from elftools.elf.elffile import ELFFile
+
+CLOCK = 80000000
+
+record = re.compile(r"@L ((?:[0-9a-f]{8} ?){7})")
+spec = re.compile(r"%([-+ 0#]*)(\d+|\*)?(?:\.(\d+|\*))?(?:hh|h|ll|l|j|z|t)?"
+                  r"([diuxXocsp%])")
+
+
+class Strings:
+    def __init__(self, path):
+        self.sections = []
+        with open(path, "rb") as f:
+            for section in ELFFile(f).iter_sections():
+                if section["sh_addr"] and section["sh_type"] == "SHT_PROGBITS":
+                    self.sections.append((section["sh_addr"], section.data()))
+
+    def get(self, address):
+        for start, data in self.sections:
+            if start <= address < start + len(data):
+                end = data.find(b"\0", address - start)
+                if end < 0:
+                    end = len(data)
+                return data[address - start:end].decode(errors="replace")
+        return "<bad string 0x%08x>" % address
+
+
+def signed(value):
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def decode(strings, format, args):
+    args = iter(args)
+
+    def convert(match):
+        flags, width, precision, kind = match.groups()
+        if kind == "%":
+            return "%"
+        if width == "*":
+            width = str(signed(next(args, 0)))
+        if precision == "*":
+            precision = str(next(args, 0))
+        py = "%" + flags + (width or "")
+        if precision:
+            py += "." + precision
+        value = next(args, 0)
+        if kind in "di":
+            return (py + "d") % signed(value)
+        if kind == "u":
+            return (py + "d") % value
+        if kind == "c":
+            return (py + "c") % chr(value & 0xff)
+        if kind == "s":
+            return (py + "s") % strings.get(value)
+        if kind == "p":
+            return (py + "s") % ("0x%08x" % value)
+        return (py + kind) % value
+
+    return spec.sub(convert, format)
+
+
+def lines(source):
+    if source is None:
+        yield from sys.stdin
+    elif stat.S_ISCHR(os.stat(source).st_mode):
+        with serial.Serial(source, 115200, timeout=1) as ser:
+            ser.write(b"log\r")
+            while True:
+                line = ser.readline()
+                if not line:
+                    break
+                yield line.decode(errors="replace")
+    else:
+        with open(source, errors="replace") as f:
+            yield from f
+
+
+if len(sys.argv) < 2:
+    print("usage: %s ELF [CAPTURE]" % sys.argv[0])
+    sys.exit(1)
+
+strings = Strings(sys.argv[1])
+last_seq = None
+for line in lines(sys.argv[2] if len(sys.argv) > 2 else None):
+    match = record.search(line)
+    if not match:
+        continue
+    seq, time, format, *args = (int(x, 16) for x in match.group(1).split())
+    if last_seq is not None and seq != last_seq + 1:
+        print("... %d records lost" % (seq - last_seq - 1))
+    last_seq = seq
+    text = decode(strings, strings.get(format), args)
+    print("[%12.6f] %s" % (time / CLOCK, text.rstrip()))
@@ -0,0 +1,137 @@
+#!/usr/bin/python
+
+# Convert the kernel event trace printed by the `trace` command (or saved with
+# `trace save`) into Chrome trace JSON, which can be opened in
+# chrome://tracing or https://ui.perfetto.dev. The OS has to be built with
+# TRACE_KERNEL defined in inc/trace.h.
+#
+# usage: trace2json.py [CAPTURE] > trace.json
+#   CAPTURE is a file with the output of `trace`, reads stdin if left out
+
+import json
+import re
+import sys
+
+CLOCK = 80000000
+
+SWITCH, THREAD, EXIT, READY, WAIT, SIGNAL, SLEEP, TIMEOUT, ISR_ENTER, \
+    ISR_EXIT = range(10)
+
+VECTORS = {
+    21: "uart0", 35: "timer0a", 37: "timer1a (sleep)", 39: "timer2a (periodic)",
+    46: "gpio_portf", 49: "uart2 (esp)", 51: "timer3a", 60: "usb0",
+    64: "adc1_sequence0", 86: "timer4a", 108: "timer5a", 110: "wtimer0a",
+    112: "wtimer1a", 114: "wtimer2a", 116: "wtimer3a", 118: "wtimer4a",
+    120: "wtimer5a",
+}
+
+PID = 1
+ISR_TID = 1000  # interrupts get their own tracks after the threads
+STORM_WINDOW = 1000  # us to count interrupts over
+
+event_line = re.compile(r"@K ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+)")
+name_line = re.compile(r"@N ([0-9a-f]+) (.*?)\s*$")
+
+source = open(sys.argv[1], errors="replace") if len(sys.argv) > 1 \
+    else sys.stdin
+events = []
+names = {}
+for line in source:
+    match = event_line.search(line)
+    if match:
+        events.append([int(x, 16) for x in match.groups()])
+        continue
+    match = name_line.search(line)
+    if match:
+        names[int(match.group(1), 16)] = match.group(2)
+
+# the OS timer is 32 bits so it wraps every ~53s
+offset = 0
+last = 0
+for event in events:
+    if event[0] + offset < last:
+        offset += 1 << 32
+    event[0] += offset
+    last = event[0]
+
+out = []
+
+
+def us(time):
+    return time * 1000000 / CLOCK
+
+
+def instant(time, tid, name, args):
+    out.append({"name": name, "ph": "i", "s": "t", "ts": us(time), "pid": PID,
+                "tid": tid, "args": args})
+
+
+running = None  # (thread id, priority, when it was switched in)
+isr_depth = {}
+isr_count = 0
+window_start = None
+for time, kind, a, b in events:
+    current = running[0] if running else 0
+    if kind == SWITCH:
+        if running:
+            thread, priority, start = running
+            out.append({"name": names.get(thread, "thread %d" % thread),
+                        "ph": "X", "ts": us(start), "dur": us(time - start),
+                        "pid": PID, "tid": thread,
+                        "args": {"priority": priority}})
+        running = (a, b, time)
+    elif kind == THREAD:
+        instant(time, a, "created", {"by": current})
+    elif kind == EXIT:
+        instant(time, a, "exit", {})
+    elif kind == READY:
+        instant(time, a, "ready", {"priority": b, "by": current})
+    elif kind == WAIT:
+        instant(time, current, "wait (blocked)" if b else "wait",
+                {"semaphore": "0x%08x" % a})
+    elif kind == SIGNAL:
+        instant(time, current, "signal",
+                {"semaphore": "0x%08x" % a, "woke": b})
+    elif kind == SLEEP:
+        instant(time, a, "sleep", {"us": us(b)})
+    elif kind == TIMEOUT:
+        instant(time, a, "timeout", {})
+    elif kind == ISR_ENTER:
+        isr_depth[a] = isr_depth.get(a, 0) + 1
+        out.append({"name": VECTORS.get(a, "vector %d" % a), "ph": "B",
+                    "ts": us(time), "pid": PID, "tid": ISR_TID + a})
+        # interrupt rate, so storms show up as spikes
+        if window_start is None:
+            window_start = time
+        isr_count += 1
+        if us(time - window_start) >= STORM_WINDOW:
+            out.append({"name": "interrupts/ms", "ph": "C",
+                        "ts": us(window_start), "pid": PID,
+                        "args": {"count": isr_count * 1000 /
+                                 us(time - window_start)}})
+            window_start = time
+            isr_count = 0
+    elif kind == ISR_EXIT:
+        # the matching entry may have been overwritten
+        if isr_depth.get(a):
+            isr_depth[a] -= 1
+            out.append({"ph": "E", "ts": us(time), "pid": PID,
+                        "tid": ISR_TID + a})
+
+if running and events:
+    thread, priority, start = running
+    out.append({"name": names.get(thread, "thread %d" % thread), "ph": "X",
+                "ts": us(start), "dur": us(events[-1][0] - start), "pid": PID,
+                "tid": thread, "args": {"priority": priority}})
+
+out.append({"name": "process_name", "ph": "M", "pid": PID,
+            "args": {"name": "TM4C"}})
+for thread, name in names.items():
+    out.append({"name": "thread_name", "ph": "M", "pid": PID, "tid": thread,
+                "args": {"name": "%s (%d)" % (name, thread)}})
+for vector in isr_depth:
+    out.append({"name": "thread_name", "ph": "M", "pid": PID,
+                "tid": ISR_TID + vector,
+                "args": {"name": "ISR " + VECTORS.get(vector, str(vector))}})
+
+json.dump({"traceEvents": out, "displayTimeUnit": "ns"}, sys.stdout)
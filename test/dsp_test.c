@@ -0,0 +1,385 @@
+// Checks the fixed point kernels in lib/dsp.c (with the SIMD instructions
+// done in C) against double precision versions of the same filters, run on
+// the same quantized coefficients. Errors are in LSBs of the output format.
+// Filters are fed in blocks of random sizes, some in place, to check that
+// their state carries over.
+#include "dsp.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI // not in strict C
+#define M_PI 3.14159265358979323846
+#endif
+
+#define N 4096
+#define TAPS 32
+#define DECIMATE 3
+#define STAGES 2
+
+static int failures;
+
+static void check(const char* name, double error, double tolerance) {
+    bool ok = error <= tolerance;
+    printf("%-24s max error %9.3f LSB   tolerance %6g   %s\n", name, error,
+           tolerance, ok ? "ok" : "FAIL");
+    failures += !ok;
+}
+
+static void expect(const char* name, bool ok) {
+    printf("%-24s %s\n", name, ok ? "ok" : "FAIL");
+    failures += !ok;
+}
+
+// a few tones plus noise, peaking at about amplitude of full scale
+static double signal(uint32_t i, double amplitude) {
+    double noise = 2.0 * rand() / RAND_MAX - 1;
+    return amplitude * (0.5 * sin(0.013 * i) + 0.3 * sin(0.41 * i + 1) +
+                        0.2 * noise);
+}
+
+static q15_t to_q15(double x) {
+    double scaled = round(x * 32768);
+    return scaled > INT16_MAX ? INT16_MAX : scaled < INT16_MIN ? INT16_MIN
+                                                                : scaled;
+}
+
+static q31_t to_q31(double x) {
+    double scaled = round(x * 2147483648.0);
+    return scaled > INT32_MAX ? INT32_MAX : scaled < INT32_MIN ? INT32_MIN
+                                                                : scaled;
+}
+
+static uint32_t block_size(void) {
+    return 1 + rand() % 300;
+}
+
+// windowed sinc lowpass with a cutoff of fc cycles per sample
+static void lowpass(double* h, int taps, double fc) {
+    double sum = 0;
+    for (int k = 0; k < taps; k++) {
+        double t = k - (taps - 1) / 2.0;
+        double sinc = t ? sin(2 * M_PI * fc * t) / (M_PI * t) : 2 * fc;
+        h[k] = sinc * (0.54 - 0.46 * cos(2 * M_PI * k / (taps - 1)));
+        sum += h[k];
+    }
+    for (int k = 0; k < taps; k++) { h[k] /= sum; }
+}
+
+static double fir_reference(const double* h, const double* x, uint32_t i) {
+    double acc = 0;
+    for (uint32_t k = 0; k < TAPS && k <= i; k++) { acc += h[k] * x[i - k]; }
+    return acc;
+}
+
+static void test_fir_q15(void) {
+    double design[TAPS], h[TAPS], x[N];
+    q15_t coeffs[TAPS], in[N], out[N];
+    lowpass(design, TAPS, 0.1);
+    for (int k = 0; k < TAPS; k++) {
+        coeffs[k] = to_q15(design[k]);
+        h[k] = coeffs[k] / 32768.0;
+    }
+    for (uint32_t i = 0; i < N; i++) {
+        in[i] = to_q15(signal(i, 0.9));
+        x[i] = in[i] / 32768.0;
+    }
+
+    FIRQ15* fir = fir_q15_new(coeffs, TAPS);
+    for (uint32_t i = 0, n; i < N; i += n) {
+        n = block_size();
+        n = n < N - i ? n : N - i;
+        if (rand() & 1) {
+            fir_q15(fir, &in[i], &out[i], n);
+        } else {
+            memcpy(&out[i], &in[i], n * sizeof(q15_t));
+            fir_q15(fir, &out[i], &out[i], n);
+        }
+    }
+    fir_q15_free(fir);
+    double error = 0;
+    for (uint32_t i = 0; i < N; i++) {
+        error = fmax(error, fabs(out[i] - fir_reference(h, x, i) * 32768));
+    }
+    check("fir_q15", error, 1); // rounded down
+
+    fir = fir_q15_new(coeffs, TAPS);
+    uint32_t written = 0;
+    for (uint32_t i = 0, n; i < N; i += n) {
+        n = block_size();
+        n = n < N - i ? n : N - i;
+        written += fir_q15_decimate(fir, &in[i], &out[written], n, DECIMATE);
+    }
+    fir_q15_free(fir);
+    error = 0;
+    for (uint32_t j = 0; j < written; j++) {
+        double ref = fir_reference(h, x, (j + 1) * DECIMATE - 1);
+        error = fmax(error, fabs(out[j] - ref * 32768));
+    }
+    check("fir_q15_decimate", error, 1);
+    expect("decimated length", written == N / DECIMATE);
+    expect("odd taps rejected", !fir_q15_new(coeffs, TAPS - 1));
+}
+
+static void test_fir_q31(void) {
+    double design[TAPS], h[TAPS], x[N];
+    q31_t coeffs[TAPS], in[N], out[N];
+    lowpass(design, TAPS, 0.1);
+    for (int k = 0; k < TAPS; k++) {
+        coeffs[k] = to_q31(design[k]);
+        h[k] = coeffs[k] / 2147483648.0;
+    }
+    for (uint32_t i = 0; i < N; i++) {
+        in[i] = to_q31(signal(i, 0.9));
+        x[i] = in[i] / 2147483648.0;
+    }
+    FIRQ31* fir = fir_q31_new(coeffs, TAPS);
+    for (uint32_t i = 0, n; i < N; i += n) {
+        n = block_size();
+        n = n < N - i ? n : N - i;
+        fir_q31(fir, &in[i], &out[i], n);
+    }
+    fir_q31_free(fir);
+    double error = 0;
+    for (uint32_t i = 0; i < N; i++) {
+        double ref = fir_reference(h, x, i) * 2147483648.0;
+        error = fmax(error, fabs(out[i] - ref));
+    }
+    check("fir_q31", error, 1);
+}
+
+// 4th order Butterworth lowpass as two sections, coefficients {b0, b1, b2,
+// a1, a2}
+static void butterworth(double (*c)[5], double fc) {
+    double k = tan(M_PI * fc);
+    for (int s = 0; s < STAGES; s++) {
+        double q = 1 / (2 * cos(M_PI * (2 * s + 1) / (4 * STAGES)));
+        double norm = 1 / (1 + k / q + k * k);
+        c[s][0] = k * k * norm;
+        c[s][1] = 2 * c[s][0];
+        c[s][2] = c[s][0];
+        c[s][3] = 2 * (k * k - 1) * norm;
+        c[s][4] = (1 - k / q + k * k) * norm;
+    }
+}
+
+// direct form 1 like the fixed point version, but with nothing rounded
+static void biquad_reference(double (*c)[5], const double* in, double* out,
+                             uint32_t n, int stages) {
+    for (int s = 0; s < stages; s++) {
+        double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            double x = in[i];
+            double y = c[s][0] * x + c[s][1] * x1 + c[s][2] * x2 -
+                       c[s][3] * y1 - c[s][4] * y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            out[i] = y;
+        }
+        in = out;
+    }
+}
+
+// Each section rounds its output down by less than 1 LSB, and that error goes
+// through the section's feedback and then the later sections. The sum of the
+// magnitudes of that impulse response bounds how much it can add up to.
+static double biquad_error_bound(double (*c)[5]) {
+    static double h[N];
+    double bound = 0;
+    for (int s = 0; s < STAGES; s++) {
+        double y1 = 0, y2 = 0;
+        for (uint32_t i = 0; i < N; i++) {
+            h[i] = (i == 0) - c[s][3] * y1 - c[s][4] * y2;
+            y2 = y1;
+            y1 = h[i];
+        }
+        biquad_reference(c + s + 1, h, h, N, STAGES - s - 1);
+        for (uint32_t i = 0; i < N; i++) { bound += fabs(h[i]); }
+    }
+    return bound;
+}
+
+static void test_biquad_q15(void) {
+    double design[STAGES][5], c[STAGES][5], x[N], ref[N];
+    int16_t coeffs[STAGES][5];
+    q15_t in[N], out[N];
+    butterworth(design, 0.05);
+    for (int s = 0; s < STAGES; s++) {
+        for (int j = 0; j < 5; j++) {
+            coeffs[s][j] = round(design[s][j] * 16384);
+            c[s][j] = coeffs[s][j] / 16384.0;
+        }
+    }
+    for (uint32_t i = 0; i < N; i++) {
+        in[i] = to_q15(signal(i, 0.5));
+        x[i] = in[i] / 32768.0;
+    }
+    biquad_reference(c, x, ref, N, STAGES);
+    BiquadQ15* iir = biquad_q15_new(coeffs, STAGES);
+    for (uint32_t i = 0, n; i < N; i += n) {
+        n = block_size();
+        n = n < N - i ? n : N - i;
+        biquad_q15(iir, &in[i], &out[i], n);
+    }
+    biquad_q15_free(iir);
+    double error = 0;
+    for (uint32_t i = 0; i < N; i++) {
+        error = fmax(error, fabs(out[i] - ref[i] * 32768));
+    }
+    check("biquad_q15", error, biquad_error_bound(c));
+
+    coeffs[1][3] = INT16_MIN;
+    expect("biquad_q15 a1 = -2 rejected", !biquad_q15_new(coeffs, STAGES));
+}
+
+static void test_biquad_q31(void) {
+    double design[STAGES][5], c[STAGES][5], x[N], ref[N];
+    int32_t coeffs[STAGES][5];
+    q31_t in[N], out[N];
+    butterworth(design, 0.05);
+    for (int s = 0; s < STAGES; s++) {
+        for (int j = 0; j < 5; j++) {
+            coeffs[s][j] = round(design[s][j] * 1073741824.0);
+            c[s][j] = coeffs[s][j] / 1073741824.0;
+        }
+    }
+    for (uint32_t i = 0; i < N; i++) {
+        in[i] = to_q31(signal(i, 0.5));
+        x[i] = in[i] / 2147483648.0;
+    }
+    biquad_reference(c, x, ref, N, STAGES);
+    BiquadQ31* iir = biquad_q31_new(coeffs, STAGES);
+    for (uint32_t i = 0, n; i < N; i += n) {
+        n = block_size();
+        n = n < N - i ? n : N - i;
+        biquad_q31(iir, &in[i], &out[i], n);
+    }
+    biquad_q31_free(iir);
+    double error = 0;
+    for (uint32_t i = 0; i < N; i++) {
+        error = fmax(error, fabs(out[i] - ref[i] * 2147483648.0));
+    }
+    check("biquad_q31", error, biquad_error_bound(c));
+}
+
+static void test_moving_average(void) {
+    const uint16_t lengths[] = {1, 10, 16};
+    q15_t in[N], out[N];
+    for (uint32_t i = 0; i < N; i++) { in[i] = to_q15(signal(i, 1)); }
+    for (int l = 0; l < 3; l++) {
+        uint16_t len = lengths[l];
+        MovingAverage* avg = moving_average_new(len);
+        for (uint32_t i = 0, n; i < N; i += n) {
+            n = block_size();
+            n = n < N - i ? n : N - i;
+            moving_average_block(avg, &in[i], &out[i], n);
+        }
+        moving_average_free(avg);
+        double error = 0;
+        for (uint32_t i = 0; i < N; i++) {
+            double sum = 0;
+            for (uint32_t k = 0; k < len && k <= i; k++) { sum += in[i - k]; }
+            error = fmax(error, fabs(out[i] - sum / len));
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "moving_average %d", len);
+        check(name, error, 1); // rounded towards 0
+    }
+}
+
+static void test_stats(void) {
+    q15_t in[N];
+    double rms_error = 0, peak_error = 0;
+    for (int trial = 0; trial < 100; trial++) {
+        uint32_t n = 1 + rand() % N;
+        double amplitude = (rand() % 100 + 1) / 100.0;
+        for (uint32_t i = 0; i < n; i++) {
+            in[i] = to_q15(signal(i + trial, amplitude * 1.2));
+        }
+        double squares = 0, largest = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            squares += (double)in[i] * in[i];
+            largest = fmax(largest, fabs(in[i]));
+        }
+        q15_t rms, peak;
+        q15_stats(in, n, &rms, &peak);
+        rms_error = fmax(rms_error, fabs(rms - sqrt(squares / n)));
+        peak_error = fmax(peak_error, fabs(peak - fmin(largest, INT16_MAX)));
+    }
+    check("q15_stats rms", rms_error, 1); // rounded down
+    check("q15_stats peak", peak_error, 0);
+}
+
+static void test_fft(void) {
+    static q15_t data[2 * 1024];
+    static double re[1024], im[1024];
+    for (uint16_t n = 2; n <= 1024; n *= 2) {
+        for (uint32_t i = 0; i < n; i++) {
+            data[2 * i] = to_q15(signal(i, 0.9));
+            data[2 * i + 1] = to_q15(signal(i + 7, 0.9));
+            re[i] = data[2 * i];
+            im[i] = data[2 * i + 1];
+        }
+        fft_q15(data, n);
+        double error = 0;
+        for (uint32_t k = 0; k < n; k++) {
+            double sum_re = 0, sum_im = 0;
+            for (uint32_t i = 0; i < n; i++) {
+                double angle = -2 * M_PI * ((uint64_t)i * k % n) / n;
+                sum_re += re[i] * cos(angle) - im[i] * sin(angle);
+                sum_im += re[i] * sin(angle) + im[i] * cos(angle);
+            }
+            error = fmax(error, fabs(data[2 * k] - sum_re / n));
+            error = fmax(error, fabs(data[2 * k + 1] - sum_im / n));
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "fft_q15 %d", n);
+        // a rounding per stage plus the twiddle table's error
+        check(name, error, 2 + __builtin_ctz(n));
+    }
+    expect("fft_q15 rejects 3", !fft_q15(data, 3));
+    expect("fft_q15 rejects 2048", !fft_q15(data, 2048));
+}
+
+static void test_elementwise(void) {
+    uint16_t adc[N + 1];
+    q15_t a[N + 1], b[N + 1], out[N + 1];
+    bool adc_ok = true, add_ok = true;
+    for (uint32_t i = 0; i <= N; i++) {
+        adc[i] = rand() & 0xfff;
+        a[i] = rand();
+        b[i] = rand();
+    }
+    adc_to_q15(adc, out, N + 1); // odd length for the leftover sample
+    for (uint32_t i = 0; i <= N; i++) {
+        adc_ok &= out[i] == adc[i] * 16 - 32768;
+    }
+    q15_add(a, b, out, N + 1);
+    for (uint32_t i = 0; i <= N; i++) {
+        int32_t sum = a[i] + b[i];
+        add_ok &= out[i] == (sum > INT16_MAX   ? INT16_MAX
+                             : sum < INT16_MIN ? INT16_MIN
+                                               : sum);
+    }
+    expect("adc_to_q15", adc_ok);
+    expect("q15_add", add_ok);
+}
+
+int main(void) {
+    srand(1);
+    test_elementwise();
+    test_fir_q15();
+    test_fir_q31();
+    test_biquad_q15();
+    test_biquad_q31();
+    test_moving_average();
+    test_stats();
+    test_fft();
+    printf(failures ? "%d dsp checks failed\n" : "dsp ok\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,191 @@
+// Accuracy sweep of lib/fastmath.c against libm in double precision, checked
+// against the bounds documented in inc/fastmath.h, and a throughput
+// comparison with libm's float functions (on the host, so only the ratios say
+// anything about the target).
+#define sin target_sin
+#define cos target_cos
+#define sqrtf target_sqrtf
+#define atan2f target_atan2f
+#define expf target_expf
+#define logf target_logf
+#include "fastmath.h"
+#undef sin
+#undef cos
+#undef sqrtf
+#undef atan2f
+#undef expf
+#undef logf
+
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef M_PI // not in strict C
+#define M_PI 3.14159265358979323846
+#endif
+
+static int failures;
+
+static void check(const char* name, double error, double where,
+                  double tolerance) {
+    bool ok = error <= tolerance;
+    printf("%-30s max error %-9.3g at %-12.6g bound %-8.3g %s\n", name,
+           error, where, tolerance, ok ? "ok" : "FAIL");
+    failures += !ok;
+}
+
+static void expect(const char* name, bool ok) {
+    printf("%-30s %s\n", name, ok ? "ok" : "FAIL");
+    failures += !ok;
+}
+
+// worst absolute error of sin and cos over [-limit, limit]
+static void sweep_trig(const char* name, double limit, double tolerance) {
+    double error = 0, where = 0;
+    double step = limit / 2000000;
+    for (double d = -limit; d <= limit; d += step) {
+        float x = d;
+        double e = fmax(fabs(target_sin(x) - sin(x)),
+                        fabs(target_cos(x) - cos(x)));
+        if (e > error) {
+            error = e;
+            where = x;
+        }
+    }
+    check(name, error, where, tolerance);
+}
+
+static void accuracy(void) {
+    sweep_trig("sin/cos |x| <= pi", M_PI, 2e-5);
+    sweep_trig("sin/cos |x| < 512", 512, 2e-5);
+    sweep_trig("sin/cos |x| < 400000", 400000, 2e-5);
+    check("sin(100000)", fabs(target_sin(1e5f) - sin(1e5f)), 1e5, 2e-5);
+
+    double error = 0, where = 0;
+    for (uint32_t a = 0; a < 65536; a++) {
+        double s = fmin(round(32768 * sin(a * 2 * M_PI / 65536)), 32767);
+        double c = fmin(round(32768 * cos(a * 2 * M_PI / 65536)), 32767);
+        double e = fmax(fabs(sin_q15(a) - s), fabs(cos_q15(a) - c));
+        if (e > error) {
+            error = e;
+            where = a;
+        }
+    }
+    check("sin_q15/cos_q15 (LSB)", error, where, 1);
+
+    bool exact = true;
+    for (double d = 1e-30; d < 1e30; d *= 1.0001) {
+        float x = d;
+        exact &= target_sqrtf(x) == (float)sqrt(x);
+    }
+    expect("sqrtf correctly rounded", exact);
+
+    exact = isqrt(0xFFFFFFFF) == 65535;
+    srand(1);
+    for (uint32_t i = 0; i < 1000000; i++) {
+        uint32_t x = i < 70000 ? i * i + (i & 1 ? -1u : 0)
+                               : (uint32_t)rand() << 1 ^ rand();
+        exact &= isqrt(x) == (uint32_t)floor(sqrt(x));
+    }
+    expect("isqrt rounded down", exact);
+
+    error = 0;
+    for (double y = -3; y < 3; y += 0.0031) {
+        for (double x = -3; x < 3; x += 0.0029) {
+            double e = fabs(target_atan2f(y, x) - atan2((float)y, (float)x));
+            if (e > error) {
+                error = e;
+                where = atan2(y, x);
+            }
+        }
+    }
+    check("atan2f (at angle)", error, where, 3e-6);
+
+    error = 0;
+    for (double d = -87.33; d < 88.72; d += 0.00013) {
+        float x = d;
+        double e = fabs(target_expf(x) - exp(x)) / exp(x);
+        if (e > error) {
+            error = e;
+            where = x;
+        }
+    }
+    check("expf relative", error, where, 3e-7);
+    float largest = nextafterf(logf(FLT_MAX), 0);
+    expect("expf finite up to ln(FLT_MAX)", isfinite(target_expf(largest)) &&
+                                                isfinite(target_expf(88.5f)));
+    expect("expf overflows past it",
+           isinf(target_expf(nextafterf(logf(FLT_MAX), 100))) &&
+               isinf(target_expf(1000)));
+    expect("expf underflows to 0", target_expf(-100) == 0);
+
+    error = 0;
+    for (double d = FLT_MIN; d < FLT_MAX; d *= 1.00007) {
+        float x = d;
+        double e = fabs(target_logf(x) - log(x));
+        if (fabs(log(x)) > 1) {
+            e /= fabs(log(x));
+        }
+        if (e > error) {
+            error = e;
+            where = x;
+        }
+    }
+    check("logf", error, where, 2e-7);
+    expect("logf edges", isinf(target_logf(0)) && isnan(target_logf(-1)));
+}
+
+#define CALLS 10000000
+
+static double seconds(void) {
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// ns per call of f and g over the same inputs
+#define TIME(name, f, g, input)                                                \
+    do {                                                                       \
+        volatile float sink = 0;                                               \
+        double start = seconds();                                              \
+        for (uint32_t i = 0; i < CALLS; i++) { sink += f(input); }             \
+        double ours = seconds() - start;                                       \
+        start = seconds();                                                     \
+        for (uint32_t i = 0; i < CALLS; i++) { sink += g(input); }             \
+        double libm = seconds() - start;                                       \
+        printf("%-10s %8.2f %8.2f\n", name, ours * 1e9 / CALLS,               \
+               libm * 1e9 / CALLS);                                            \
+        (void)sink;                                                            \
+    } while (0)
+
+static float atan2_one(float y) {
+    return target_atan2f(y, 0.5f);
+}
+
+static float atan2_libm(float y) {
+    return atan2f(y, 0.5f);
+}
+
+static void throughput(void) {
+    printf("\nns per call  fastmath     libm\n");
+    TIME("sin", target_sin, sinf, i * 0.001f - 5000);
+    TIME("cos", target_cos, cosf, i * 0.001f - 5000);
+    TIME("sqrtf", target_sqrtf, sqrtf, i * 0.37f);
+    TIME("atan2f", atan2_one, atan2_libm, i * 1e-6f - 5);
+    TIME("expf", target_expf, expf, i * 1.7e-5f - 85);
+    TIME("logf", target_logf, logf, i * 0.37f + 1e-3f);
+}
+
+int main(int argc, char** argv) {
+    accuracy();
+    if (argc > 1) { // the benchmark takes a few seconds
+        throughput();
+    }
+    printf(failures ? "%d fastmath checks failed\n" : "fastmath ok\n",
+           failures);
+    return failures != 0;
+}
@@ -0,0 +1,16 @@
+// The target's heap functions (inc/heap.h) on top of libc's, for the modules
+// built for the host tests
+#include <stdint.h>
+#include <stdlib.h>
+
+void* target_malloc(uint32_t size) {
+    return malloc(size);
+}
+
+void* target_calloc(uint32_t size) {
+    return calloc(1, size);
+}
+
+void target_free(void* allocation) {
+    free(allocation);
+}
@@ -0,0 +1,266 @@
+// Fuzzes the word at a time mem* and str* functions in lib/std.c against libc
+// at random alignments, lengths and contents, and measures cycles per byte
+// against the byte loops they replaced. std.o is built with every symbol
+// given a std_ prefix. On the host the LDM/STM bursts are plain C, so the
+// benchmark only shows what working a word at a time buys, not the burst.
+//
+// `./std_test bench` on a shared x86-64 host (gcc -O2, no vectorizing), in
+// TSC cycles per byte with aligned buffers; runs vary by about a third:
+//
+//   bytes       16    64   256  4096      16    64   256  4096
+//            word at a time              byte loop
+//   memset    0.47  0.19  0.10  0.09    1.82  1.72  1.05  0.84
+//   memcpy    0.47  0.23  0.13  0.12    1.42  0.87  0.96  0.86
+//   memcmp    1.00  0.35  0.24  0.22    1.17  0.93  1.02  0.84
+//   memchr    0.94  0.64  0.44  0.41    1.29  1.43  1.46  1.32
+//   strlen    1.14  0.52  0.44  0.36    1.57  1.01  1.19  0.86
+//   strchr    1.01  0.62  0.41  0.37    1.41  1.55  1.17  1.10
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+// lib/std.c's versions, which differ from libc's in their return types
+void std_memset(void* dest, uint8_t value, uint32_t n);
+void std_memcpy(void* dest, const void* src, uint32_t n);
+int32_t std_memcmp(const void* s1, const void* s2, uint32_t n);
+void* std_memchr(const void* s, int32_t c, uint32_t n);
+uint16_t std_strlen(const char* s);
+char* std_strchr(const char* str, int32_t c);
+uint32_t std_udiv64(uint64_t n, uint32_t d);
+
+#define SIZE 512
+#define GUARD 0xA5
+
+static int failures;
+
+static void fail(const char* name, uint32_t offset, uint32_t n) {
+    if (failures++ < 10) {
+        printf("%s wrong at offset %u length %u\n", name, offset, n);
+    }
+}
+
+// xorshift, since rand() would take most of the time
+static uint32_t next(void) {
+    static uint32_t state = 1;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// small alphabets so matches and equal runs are common, with the high bit set
+// half the time to catch false positives in HAS_ZERO
+static void fill(uint8_t* buffer, uint32_t n) {
+    uint32_t alphabet = 1 + next() % 4;
+    for (uint32_t i = 0; i < n; i++) {
+        buffer[i] = (next() % alphabet) * 0x21 + (next() & 1 ? 0x80 : 0);
+    }
+}
+
+static int sign(int n) {
+    return (n > 0) - (n < 0);
+}
+
+// every quotient that fits in 32 bits, over divisors and dividends of all
+// sizes
+static void check_udiv64(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t d = next() >> next() % 32;
+        d += !d;
+        uint64_t q = next() >> next() % 32;
+        uint64_t n = q * d + next() % d;
+        if (std_udiv64(n, d) != n / d) {
+            failures++;
+            printf("udiv64 wrong for %llu / %u\n", (unsigned long long)n, d);
+            return;
+        }
+    }
+}
+
+static void fuzz(uint32_t iterations) {
+    static uint8_t a[SIZE + 64], b[SIZE + 64], expected[SIZE + 64];
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t dest = next() % 8, src = next() % 8;
+        uint32_t n = next() & 1 ? next() % 40 : next() % SIZE;
+
+        // memcpy and memset mustn't touch anything outside the range
+        memset(a, GUARD, sizeof(a));
+        fill(b, sizeof(b));
+        memcpy(expected, a, sizeof(a));
+        memcpy(expected + dest, b + src, n);
+        std_memcpy(a + dest, b + src, n);
+        if (memcmp(a, expected, sizeof(a))) {
+            fail("memcpy", dest * 8 + src, n);
+        }
+        uint8_t value = next();
+        memset(expected + dest, value, n);
+        std_memset(a + dest, value, n);
+        if (memcmp(a, expected, sizeof(a))) {
+            fail("memset", dest, n);
+        }
+
+        // equal, or different at one random place
+        fill(a, sizeof(a));
+        memcpy(b + src, a + dest, n);
+        if (n && next() & 1) {
+            b[src + next() % n] ^= 1 << next() % 8;
+        }
+        if (sign(std_memcmp(a + dest, b + src, n)) !=
+            sign(memcmp(a + dest, b + src, n))) {
+            fail("memcmp", dest * 8 + src, n);
+        }
+
+        // a byte that's there, or probably isn't, with int values past 255
+        int32_t c = n && next() & 1 ? a[dest + next() % n] : (int32_t)next();
+        if (std_memchr(a + dest, c, n) != memchr(a + dest, c, n)) {
+            fail("memchr", dest, n);
+        }
+        a[dest + n] = 0;
+        if (std_strlen((char*)a + dest) != strlen((char*)a + dest)) {
+            fail("strlen", dest, n);
+        }
+        if (std_strchr((char*)a + dest, c) != strchr((char*)a + dest, c) ||
+            std_strchr((char*)a + dest, 0) != strchr((char*)a + dest, 0)) {
+            fail("strchr", dest, n);
+        }
+    }
+}
+
+// The byte loops std.c used before, kept out of line so the compiler can't
+// fold them into the benchmark loop
+
+__attribute__((noinline)) static void byte_memset(void* dest, uint8_t value,
+                                                  uint32_t n) {
+    for (uint8_t* p = dest; n; n--) { *p++ = value; }
+}
+
+__attribute__((noinline)) static void byte_memcpy(void* dest, const void* src,
+                                                  uint32_t n) {
+    uint8_t* a = dest;
+    const uint8_t* b = src;
+    while (n--) { *a++ = *b++; }
+}
+
+__attribute__((noinline)) static int32_t byte_memcmp(const void* s1,
+                                                     const void* s2,
+                                                     uint32_t n) {
+    const uint8_t *a = s1, *b = s2;
+    for (; n; n--, a++, b++) {
+        if (*a != *b) {
+            return *a < *b ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+__attribute__((noinline)) static void* byte_memchr(const void* s, int32_t c,
+                                                   uint32_t n) {
+    for (const uint8_t* p = s; n; n--, p++) {
+        if (*p == (uint8_t)c) {
+            return (void*)p;
+        }
+    }
+    return 0;
+}
+
+__attribute__((noinline)) static uint16_t byte_strlen(const char* s) {
+    const char* start = s;
+    while (*s) { s++; }
+    return s - start;
+}
+
+__attribute__((noinline)) static char* byte_strchr(const char* str,
+                                                   int32_t c) {
+    for (; *str != (char)c; str++) {
+        if (!*str) {
+            return 0;
+        }
+    }
+    return (char*)str;
+}
+
+static uint64_t cycles(void) {
+#ifdef __x86_64__
+    return __rdtsc();
+#else // nanoseconds, which are about cycles on a GHz host
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+}
+
+#define BYTES 100000000 // per measurement
+
+// cycles per byte of call into cost, n bytes at a time; the searches run the
+// whole length without finding anything and memcmp compares equal buffers
+#define MEASURE(call, n)                                                       \
+    do {                                                                       \
+        volatile uintptr_t sink = 0;                                           \
+        uint64_t start = cycles();                                             \
+        for (uint32_t i = 0; i < BYTES / (n); i++) {                          \
+            sink += (uintptr_t)(call);                                         \
+            __asm volatile("" ::: "memory");                                   \
+        }                                                                      \
+        cost = (double)(cycles() - start) / (BYTES / (n) * (n));               \
+    } while (0)
+
+static void bench(void) {
+    static const uint32_t sizes[] = {16, 64, 256, 4096};
+    static _Alignas(16) uint8_t a[4096 + 1], b[4096 + 1];
+    memset(a, 'a', sizeof(a));
+    memset(b, 'a', sizeof(b));
+    a[4096] = b[4096] = 0;
+
+    printf("\ncycles per byte        word at a time     "
+           "      byte loop\n%-8s", "bytes");
+    for (uint32_t pass = 0; pass < 2; pass++) {
+        for (uint32_t s = 0; s < 4; s++) { printf("%6u", sizes[s]); }
+        printf(pass ? "\n" : "  ");
+    }
+    const char* names[] = {"memset", "memcpy", "memcmp",
+                           "memchr", "strlen", "strchr"};
+    for (uint32_t f = 0; f < 6; f++) {
+        printf("%-8s", names[f]);
+        for (uint32_t pass = 0; pass < 2; pass++) {
+            for (uint32_t s = 0; s < 4; s++) {
+                uint32_t n = sizes[s];
+                // the strings end after n bytes
+                a[n] = b[n] = 0;
+                double cost = 0;
+                switch (f * 2 + pass) {
+                case 0: MEASURE((std_memset(a, 1, n), 0), n); break;
+                case 1: MEASURE((byte_memset(a, 1, n), 0), n); break;
+                case 2: MEASURE((std_memcpy(a, b, n), 0), n); break;
+                case 3: MEASURE((byte_memcpy(a, b, n), 0), n); break;
+                case 4: MEASURE(std_memcmp(a, b, n), n); break;
+                case 5: MEASURE(byte_memcmp(a, b, n), n); break;
+                case 6: MEASURE(std_memchr(a, 'z', n), n); break;
+                case 7: MEASURE(byte_memchr(a, 'z', n), n); break;
+                case 8: MEASURE(std_strlen((char*)a), n); break;
+                case 9: MEASURE(byte_strlen((char*)a), n); break;
+                case 10: MEASURE(std_strchr((char*)a, 'z'), n); break;
+                case 11: MEASURE(byte_strchr((char*)a, 'z'), n); break;
+                }
+                memset(a, 'a', sizeof(a) - 1);
+                memset(b, 'a', sizeof(b) - 1);
+                printf("%6.2f", cost);
+            }
+            printf(pass ? "\n" : "  ");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    fuzz(500000);
+    check_udiv64(10000000);
+    if (argc > 1) { // the benchmark takes a few seconds
+        bench();
+    }
+    printf(failures ? "%d std checks failed\n" : "std ok\n", failures);
+    return failures != 0;
+}
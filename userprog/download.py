@@ -0,0 +1,230 @@
+#!/usr/bin/python
+
+# Pull files off the board's filesystem with the interpreter's `download`
+# command, over serial or the remote interpreter's TCP connection. Files are
+# sent in CRC checked frames (see inc/transfer.h), and a file that's already
+# partly here is resumed from where it stopped, so syncing a directory of logs
+# only sends what was added since last time. The end frame has the CRC of the
+# whole file, so if the part that's here no longer matches the board's (a log
+# that was rewritten), the file is fetched again from the start.
+#
+# usage: download.py [--port PORT | --tcp HOST] FILE...
+#        download.py [--port PORT | --tcp HOST] --sync DIR
+#   close any terminal on the port first, the commands are sent from here
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+import zlib
+import serial
+
+PAYLOAD = 512
+TIMEOUT = 10  # seconds without a frame before giving up
+QUIET = 0.05  # the board has stopped sending after a bad frame
+
+
+class Serial:
+    def __init__(self, port):
+        self.port = serial.Serial(port, 115200, timeout=TIMEOUT)
+        self.newline = b"\r"
+
+    def read(self, n, timeout=TIMEOUT):
+        self.port.timeout = timeout
+        return self.port.read(n)
+
+    def write(self, data):
+        self.port.write(data)
+
+
+class Tcp:
+    def __init__(self, host):
+        self.sock = socket.create_connection((host, 23), TIMEOUT)
+        self.buffer = b""
+        self.newline = b"\n"
+
+    def read(self, n, timeout=TIMEOUT):
+        self.sock.settimeout(timeout)
+        try:
+            while len(self.buffer) < n:
+                data = self.sock.recv(4096)
+                if not data:
+                    break
+                self.buffer += data
+        except socket.timeout:
+            pass
+        out, self.buffer = self.buffer[:n], self.buffer[n:]
+        return out
+
+    def write(self, data):
+        self.sock.sendall(data)
+
+
+def read_until(conn, end):
+    out = b""
+    while not out.endswith(end):
+        c = conn.read(1)
+        if not c:
+            sys.exit("the board stopped answering")
+        out += c
+    return out.decode(errors="replace")
+
+
+def command(conn, text):
+    conn.write(text.encode() + conn.newline)
+
+
+def wait_prompt(conn):
+    read_until(conn, b"\x03")  # every prompt ends with ETX
+
+
+# f is positioned after the size bytes already here, whose CRC is crc
+# returns whether the whole file matched the end frame, or None if the
+# transfer broke off
+def receive(conn, f, size, crc):
+    expected = 0
+    while True:
+        c = conn.read(1)
+        if not c:
+            return None
+        if c != b"\x7e":
+            continue
+        header = conn.read(5)
+        bad = len(header) < 5
+        if not bad:
+            kind, seq, length = struct.unpack("<cHH", header)
+            bad = length > PAYLOAD
+        if not bad:
+            body = conn.read(length + 4)
+            bad = len(body) < length + 4 or \
+                zlib.crc32(header + body[:length]) != \
+                struct.unpack("<I", body[length:])[0]
+        if bad or seq > expected:
+            while conn.read(1, QUIET):  # skip the rest of the window
+                pass
+            conn.write(struct.pack("<cH", b"N", expected))
+            continue
+        if seq < expected:  # our answer got lost
+            conn.write(struct.pack("<cH", b"A", expected))
+            continue
+        payload = body[:length]
+        if kind == b"D":
+            f.write(payload)
+            size += length
+            crc = zlib.crc32(payload, crc)
+            expected += 1
+            conn.write(struct.pack("<cH", b"A", expected))
+        elif kind == b"E":
+            ok = struct.unpack("<II", payload) == (size, crc)
+            conn.write(struct.pack("<cH", b"A" if ok else b"X", expected + 1))
+            return ok
+        else:
+            conn.write(struct.pack("<cH", b"X", expected))
+            return None
+
+
+def local_crc(path, size):
+    crc = 0
+    with open(path, "rb") as f:
+        while size:
+            data = f.read(min(size, 65536))
+            if not data:
+                break
+            crc = zlib.crc32(data, crc)
+            size -= len(data)
+    return crc
+
+
+def download(conn, name, path):
+    offset = os.path.getsize(path) if os.path.exists(path) else 0
+    command(conn, "download %s %d" % (name, offset))
+    while True:
+        line = read_until(conn, b"\n")
+        if "@D ready" in line:
+            total = int(line.split()[-1])
+            break
+        if "ERROR" in line:
+            if offset:  # it got smaller, start over
+                os.remove(path)
+                wait_prompt(conn)
+                return download(conn, name, path)
+            print("%s: %s" % (name, line.strip()))
+            wait_prompt(conn)
+            return False
+    start = time.time()
+    with open(path, "r+b" if offset else "wb") as f:
+        f.seek(offset)
+        f.truncate()
+        ok = receive(conn, f, offset, local_crc(path, offset) if offset else 0)
+    elapsed = time.time() - start
+    # skip any frames that were sent again before the last answer got there,
+    # which could have an ETX in them
+    line = ""
+    while "Sent " not in line and "ERROR" not in line:
+        line = read_until(conn, b"\n")
+    wait_prompt(conn)
+    if ok is False and offset:  # what was here doesn't match, start over
+        print("%s: changed before byte %d, fetching it again" % (name, offset))
+        os.remove(path)
+        return download(conn, name, path)
+    sent = total - offset
+    if ok and offset and not sent:
+        print("%s: up to date" % name)
+        return True
+    print("%s: %s %d bytes%s in %.2fs (%.1f KB/s)" %
+          (name, "got" if ok else "FAILED after", sent,
+           " (resumed at %d)" % offset if offset else "", elapsed,
+           sent / max(elapsed, 0.001) / 1024))
+    return ok
+
+
+def sync(conn, directory):
+    os.makedirs(directory, exist_ok=True)
+    command(conn, "sync")
+    files = []
+    while True:
+        line = read_until(conn, b"\n").strip()
+        if line.startswith("@S done"):
+            break
+        if line.startswith("@S "):
+            files.append(line[3:].rsplit(" ", 1)[0])  # without the size
+    wait_prompt(conn)
+    ok = True
+    for name in files:
+        # even a file of the same size is resumed, which sends nothing but the
+        # end frame if it's unchanged, since a log can be rewritten to the
+        # same length
+        path = os.path.join(directory, name)
+        ok = download(conn, name, path) and ok
+    return ok
+
+
+parser = argparse.ArgumentParser(description="download files from the board")
+source = parser.add_mutually_exclusive_group()
+source.add_argument("--port", default="/dev/ttyACM0")
+source.add_argument("--tcp", metavar="HOST",
+                    help="use the remote interpreter at HOST instead")
+parser.add_argument("--sync", metavar="DIR",
+                    help="bring DIR up to date with every file on the board")
+parser.add_argument("files", nargs="*")
+args = parser.parse_args()
+if not args.sync and not args.files:
+    parser.error("pass files to download or --sync DIR")
+
+if args.tcp:
+    conn = Tcp(args.tcp)
+    read_until(conn, b"\x03")  # "Press Enter to begin..."
+    conn.write(b"\n")
+else:
+    conn = Serial(args.port)
+    conn.write(b"\r")  # get a fresh prompt
+wait_prompt(conn)
+
+ok = True
+if args.sync:
+    ok = sync(conn, args.sync)
+for name in args.files:
+    ok = download(conn, name, os.path.basename(name)) and ok
+sys.exit(0 if ok else 1)
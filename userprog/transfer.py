@@ -1,21 +1,102 @@
 #!/usr/bin/python
 
+# Upload a file to the board's filesystem with the interpreter's `upload`
+# command. The file is sent in frames of one filesystem block with a CRC-32
+# each, with up to WINDOW of them in flight, and anything that doesn't make it
+# is sent again. See inc/transfer.h for the format.
+#
+# usage: transfer.py FILE [PORT] [--name NAME] [--baud BAUD]
+#   close any terminal on the port first, the command is sent from here
+
+import argparse
+import struct
 import sys
+import time
+import zlib
 import serial
 
-if len(sys.argv) == 0:
-    print("Pass a filename to transfer over serial")
-    sys.exit()
+PAYLOAD = 512
+WINDOW = 4
+DEFAULT_BAUD = 115200
+TIMEOUT = 2  # seconds without an answer before sending again
+RETRIES = 10
 
-with open(sys.argv[1], "rb") as f:
-    contents = f.read()
 
-port = "/dev/ttyACM0"
-if len(sys.argv) > 2:
-    port = sys.argv[2]
+def frame(kind, seq, payload):
+    body = struct.pack("<cHH", kind, seq, len(payload)) + payload
+    return b"\x7e" + body + struct.pack("<I", zlib.crc32(body))
+
+
+def wait_ready(ser):
+    deadline = time.time() + 5
+    while time.time() < deadline:
+        line = ser.readline().decode(errors="replace")
+        if "@U ready" in line:
+            return
+        if "ERROR" in line:
+            sys.exit(line.strip())
+    sys.exit("the board didn't answer, is the interpreter at a prompt?")
+
+
+def send(ser, contents):
+    frames = [frame(b"D", i, contents[off:off + PAYLOAD])
+              for i, off in enumerate(range(0, len(contents), PAYLOAD))]
+    frames.append(frame(b"E", len(frames),
+                        struct.pack("<II", len(contents),
+                                    zlib.crc32(contents))))
+    base = 0  # oldest frame not acknowledged
+    sending = 0  # next frame to send
+    retries = 0
+    while base < len(frames):
+        while sending < len(frames) and sending < base + WINDOW:
+            ser.write(frames[sending])
+            sending += 1
+        answer = ser.read(3)
+        if len(answer) < 3:
+            retries += 1
+            if retries > RETRIES:
+                sys.exit("the board stopped answering")
+            sending = base
+            continue
+        kind, seq = struct.unpack("<cH", answer)
+        if kind == b"A":
+            retries = 0
+            base = max(base, seq)
+            sending = max(sending, base)
+        elif kind == b"N":
+            retries += 1
+            if retries > RETRIES:
+                sys.exit("too many bad frames, try a lower baud rate")
+            base = sending = seq
+        elif kind == b"X":
+            sys.exit("the board gave up (out of space or a bad file CRC)")
+        else:  # lost our place in the answers
+            ser.reset_input_buffer()
+
+
+parser = argparse.ArgumentParser(description="upload a file over serial")
+parser.add_argument("file")
+parser.add_argument("port", nargs="?", default="/dev/ttyACM0")
+parser.add_argument("--name", help="name on the board (default: same)")
+parser.add_argument("--baud", type=int, default=DEFAULT_BAUD,
+                    help="rate to switch to for the transfer")
+args = parser.parse_args()
+
+with open(args.file, "rb") as f:
+    contents = f.read()
+name = args.name or args.file.split("/")[-1]
 
-with serial.Serial(port, 9600) as ser:
-    ser.write(str(len(contents)).encode("UTF-8"))
-    ser.write("\r".encode("UTF-8"))
-    ser.write(contents)
-    print("File uploaded")
+with serial.Serial(args.port, DEFAULT_BAUD, timeout=TIMEOUT) as ser:
+    ser.reset_input_buffer()
+    command = "upload %s" % name
+    if args.baud != DEFAULT_BAUD:
+        command += " %d" % args.baud
+    ser.write(command.encode() + b"\r")
+    wait_ready(ser)
+    ser.baudrate = args.baud
+    start = time.time()
+    send(ser, contents)
+    elapsed = time.time() - start
+    ser.baudrate = DEFAULT_BAUD
+    print("Uploaded %d bytes in %.2fs (%.1f KB/s)" %
+          (len(contents), elapsed, len(contents) / elapsed / 1024))